@@ -0,0 +1,664 @@
+/*
+ * Microbenchmarks for the interpreter. Build the vtscript_bench target
+ * in release mode and run it. Every benchmark runs over a synthetic
+ * corpus and reports ns/op, bytes/s and heap allocations per op.
+ *
+ * Usage: vtscript_bench [--tsv] [--filter TEXT] [--min-time SECONDS]
+ *
+ * --tsv prints one tab separated line per benchmark, which is easy to
+ * diff between builds. --filter only runs benchmarks whose name
+ * contains TEXT.
+ */
+
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tokenize.hpp"
+#include "expression.hpp"
+#include "interpreter.hpp"
+#include "number.hpp"
+#include "generate.hpp"
+#include "compiled.hpp"
+#include "cache.hpp"
+#include "reader.hpp"
+#include "flat.hpp"
+#include "environment.hpp"
+
+/*
+ * Count every trip to the heap, and the bytes asked for, so
+ * allocations per op and the size of trees can be reported.
+ */
+static std::atomic<uint64_t> allocations(0);
+static std::atomic<uint64_t> allocated_bytes(0);
+
+void * operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  void * pointer = std::malloc(size == 0 ? 1 : size);
+  if (pointer == nullptr) {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void operator delete(void * pointer) noexcept {
+  std::free(pointer);
+}
+
+void operator delete(void * pointer, size_t) noexcept {
+  std::free(pointer);
+}
+
+/*
+ * Synthetic corpora. Each one is a valid program that evaluates
+ * without errors.
+ */
+
+// (+ 1 (+ 1 (+ 1 ... 1)))
+std::string deep_corpus(int depth) {
+  std::string text;
+  for (int i = 0; i < depth; i++) {
+    text += "(+ 1 ";
+  }
+  text += "1";
+  text += std::string(depth, ')');
+  return text;
+}
+
+// (begin (define v0 0) (+ v0 1) (define v1 1) (+ v1 1) ...)
+std::string wide_corpus(int width) {
+  std::string text = "(begin\n";
+  for (int i = 0; i < width; i++) {
+    std::string name = "v" + std::to_string(i);
+    text += "  (define " + name + " " + std::to_string(i) + ")\n";
+    text += "  (if (< " + name + " 100) (+ " + name + " 1) (- " + name + " 1))\n";
+  }
+  text += ")\n";
+  return text;
+}
+
+// (begin (+ 1.25 -3 4e2 ...) (* ...) ...)
+std::string numeric_corpus(int rows) {
+  std::string text = "(begin\n";
+  uint32_t state = 7;
+  for (int i = 0; i < rows; i++) {
+    text += (i % 2 == 0) ? "  (+" : "  (*";
+    for (int j = 0; j < 16; j++) {
+      state = state * 1664525u + 1013904223u;
+      text += " " + std::to_string(state % 1000) + "." + std::to_string(state % 100);
+      if (j % 5 == 4) {
+	text += "e-" + std::to_string(state % 3);
+      }
+    }
+    text += ")\n";
+  }
+  text += ")\n";
+  return text;
+}
+
+// (begin (define some-long-symbol-name-0 pi) (and ...) ...)
+std::string symbol_corpus(int rows) {
+  std::string text = "(begin\n";
+  for (int i = 0; i < rows; i++) {
+    std::string name = "some-long-symbol-name-" + std::to_string(i);
+    text += "  (define " + name + " (< pi 4))\n";
+    text += "  (and " + name + " " + name + " (not (or " + name + " " + name + ")))\n";
+  }
+  text += ")\n";
+  return text;
+}
+
+std::vector<std::string> number_corpus() {
+  std::vector<std::string> corpus;
+  uint32_t state = 1;
+  for (int i = 0; i < 100000; i++) {
+    state = state * 1664525u + 1013904223u;
+    switch (state >> 30) {
+    case 0:
+      corpus.push_back(std::to_string(state % 1000));
+      break;
+    case 1:
+      corpus.push_back(std::to_string(state % 100000) + "." + std::to_string(state % 97));
+      break;
+    case 2:
+      corpus.push_back("-" + std::to_string(state % 10000) + ".25");
+      break;
+    default:
+      corpus.push_back(std::to_string(state % 10) + "." + std::to_string(state % 1000) + "e" +
+		       std::to_string(state % 40));
+    }
+  }
+  return corpus;
+}
+
+/*
+ * A generated program with a syntax error planted every few lines, so
+ * the recovering parser has to report and skip past each one.
+ */
+std::string broken_corpus(int forms) {
+  generate::Options options;
+  options.forms = forms;
+  std::string text = "(begin\n" + generate::program(options);
+  std::string broken;
+  size_t line = 0;
+  size_t start = 0;
+  while (start < text.size()) {
+    size_t end = text.find('\n', start);
+    end = (end == std::string::npos) ? text.size() : end + 1;
+    broken.append(text, start, end - start);
+    if (++line % 7 == 0) {
+      broken += (line % 2) ? " 1abc ()\n" : " )\n";
+    }
+    start = end;
+  }
+  return broken + ")";
+}
+
+// ((((... 1 ...)))) nested far deeper than the call stack could go.
+std::string nested_corpus(int depth) {
+  std::string text(depth, '(');
+  text += "1";
+  text += std::string(depth, ')');
+  return text;
+}
+
+/*
+ * Measures the time and allocations of a batch of ops. A benchmark can
+ * pause it around setup work that shouldn't count.
+ */
+class Timer {
+public:
+  Timer() : elapsed(0), allocated(0) {
+    resume();
+  }
+  void pause() {
+    std::chrono::duration<double> span = std::chrono::steady_clock::now() - start;
+    elapsed += span.count();
+    allocated += allocations.load() - start_allocations;
+  }
+  void resume() {
+    start_allocations = allocations.load();
+    start = std::chrono::steady_clock::now();
+  }
+  double elapsed;
+  uint64_t allocated;
+private:
+  std::chrono::steady_clock::time_point start;
+  uint64_t start_allocations;
+};
+
+/*
+ * The runner. A benchmark is a function that does some number of ops
+ * and returns how many bytes of input it went through.
+ */
+struct Benchmark {
+  std::string name;
+  std::function<size_t(size_t, Timer &)> body;
+};
+
+struct Options {
+  bool tsv;
+  std::string filter;
+  double min_time;
+};
+
+static volatile double sink;
+
+void report_header(const Options & options) {
+  if (options.tsv) {
+    std::printf("name\titerations\tns_per_op\tbytes_per_sec\tallocs_per_op\n");
+  } else {
+    std::printf("%-44s %12s %14s %12s %14s\n", "benchmark", "iterations", "ns/op", "MB/s", "allocs/op");
+  }
+}
+
+void run(const Benchmark & benchmark, const Options & options) {
+  if (benchmark.name.find(options.filter) == std::string::npos) {
+    return;
+  }
+  // Warm up, then keep doubling the iterations until one batch takes
+  // at least min_time.
+  Timer warm_up;
+  benchmark.body(1, warm_up);
+  size_t iterations = 1;
+  while (true) {
+    Timer timer;
+    size_t bytes = benchmark.body(iterations, timer);
+    timer.pause();
+    if ((timer.elapsed >= options.min_time) || (iterations >= (1u << 30))) {
+      double ns_per_op = timer.elapsed * 1e9 / iterations;
+      double bytes_per_sec = bytes / timer.elapsed;
+      double allocs_per_op = (double) timer.allocated / iterations;
+      if (options.tsv) {
+	std::printf("%s\t%zu\t%.1f\t%.0f\t%.2f\n", benchmark.name.c_str(), iterations,
+		    ns_per_op, bytes_per_sec, allocs_per_op);
+      } else {
+	std::printf("%-44s %12zu %14.1f %12.1f %14.2f\n", benchmark.name.c_str(), iterations,
+		    ns_per_op, bytes_per_sec / 1e6, allocs_per_op);
+      }
+      std::fflush(stdout);
+      return;
+    }
+    iterations *= 2;
+  }
+}
+
+/*
+ * Counts reader events, so the reader has somewhere to send them.
+ */
+class CountingHandler : public reader::Handler {
+public:
+  CountingHandler() : events(0) {}
+  void on_open(uint64_t) {
+    events++;
+  }
+  void on_atom(token::Type, const char *, size_t, uint64_t) {
+    events++;
+  }
+  void on_close(uint64_t) {
+    events++;
+  }
+  void on_numbers(const double *, size_t count, uint64_t) {
+    events += count;
+  }
+  size_t events;
+};
+
+/*
+ * One set of benchmarks per corpus, one for each stage of the
+ * pipeline.
+ */
+void add_pipeline(std::vector<Benchmark> & benchmarks, const std::string & corpus,
+		  const std::string & text) {
+  // Copies so the lambdas own their input.
+  std::string source = text;
+
+  benchmarks.push_back({corpus + "/tokenize_stream", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  std::stringstream stream(source);
+	  sink = token::tokenize(stream).size();
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/tokenize", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  sink = token::tokenize(source.data(), source.size()).size();
+	}
+	return n * source.size();
+      }});
+
+  std::stringstream stream(source);
+  std::list<token::Token> tokens = token::tokenize(stream);
+  benchmarks.push_back({corpus + "/parse_tokens", [source, tokens](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  sink = parse_tokens(tokens).getChildCount();
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/parse_tokens(lexer)", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  token::Lexer lexer(source.data(), source.size());
+	  sink = parse_tokens(lexer).getChildCount();
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/parse_text", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  sink = parse_text(source.data(), source.size()).getChildCount();
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/parse_text(diagnostics)", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  std::vector<Diagnostic> diagnostics;
+	  sink = parse_text(source.data(), source.size(), diagnostics).getChildCount();
+	  sink += diagnostics.size();
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/reader::Reader", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  CountingHandler handler;
+	  reader::Reader reader(handler);
+	  reader.read(source.data(), source.size());
+	  sink = handler.events;
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/reader::Reader(packed)", [source](size_t n, Timer &) {
+	reader::Options options;
+	options.pack_numbers = true;
+	for (size_t i = 0; i < n; i++) {
+	  CountingHandler handler;
+	  reader::Reader reader(handler, options);
+	  reader.read(source.data(), source.size());
+	  sink = handler.events;
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/Interpreter::parse", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  Interpreter interpreter;
+	  sink = interpreter.parse(source.data(), source.size());
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/Interpreter::parse(hash-consed)", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  Interpreter interpreter;
+	  interpreter.setHashConsing(true);
+	  sink = interpreter.parse(source.data(), source.size());
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/Interpreter::parse(lazy)", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  Interpreter interpreter;
+	  interpreter.setLazyParsing(64);
+	  sink = interpreter.parse(source.data(), source.size());
+	}
+	return n * source.size();
+      }});
+
+  std::string compiled_source;
+  compiled::compile(source.data(), source.size(), compiled_source);
+  benchmarks.push_back({corpus + "/Interpreter::load", [source, compiled_source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  Interpreter interpreter;
+	  sink = interpreter.load(compiled_source.data(), compiled_source.size());
+	}
+	return n * source.size();
+      }});
+
+  // eval defines symbols, so every op needs a fresh interpreter. They
+  // get built and parsed with the timer paused.
+  benchmarks.push_back({corpus + "/Interpreter::eval", [source](size_t n, Timer & timer) {
+	for (size_t i = 0; i < n; i++) {
+	  timer.pause();
+	  Interpreter * interpreter = new Interpreter();
+	  interpreter->parse(source.data(), source.size());
+	  timer.resume();
+	  sink = interpreter->eval().getType();
+	  timer.pause();
+	  delete interpreter;
+	  timer.resume();
+	}
+	return n * source.size();
+      }});
+
+  Expression program = parse_text(source.data(), source.size());
+  flat::Tree tree = flat::flatten(program);
+  benchmarks.push_back({corpus + "/flat::flatten", [source, program](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  sink = flat::flatten(program).size();
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/flat::eval", [source, tree](size_t n, Timer & timer) {
+	for (size_t i = 0; i < n; i++) {
+	  timer.pause();
+	  environment::Environment * env = new environment::Environment();
+	  env->set("pi", std::atan2(0, -1));
+	  timer.resume();
+	  sink = flat::eval(tree, *env).getType();
+	  timer.pause();
+	  delete env;
+	  timer.resume();
+	}
+	return n * source.size();
+      }});
+
+  // Visit every node and add up the numbers, to compare how fast each
+  // layout can be walked.
+  benchmarks.push_back({corpus + "/walk(Expression)", [source, program](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  double total = 0;
+	  std::vector<Expression> stack = {program};
+	  while (!stack.empty()) {
+	    Expression node = std::move(stack.back());
+	    stack.pop_back();
+	    if (node.getType() == NUMBER) {
+	      total += node.getNumber();
+	    } else if (node.getType() == LIST) {
+	      for (auto & child : node.getChildren()) {
+		stack.push_back(child);
+	      }
+	    }
+	  }
+	  sink = total;
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/walk(flat)", [source, tree](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  double total = 0;
+	  std::vector<uint32_t> stack = {0};
+	  while (!stack.empty()) {
+	    uint32_t node = stack.back();
+	    stack.pop_back();
+	    if (tree.types[node] == NUMBER) {
+	      total += tree.numbers[tree.values[node]];
+	    } else if (tree.types[node] == LIST) {
+	      for (uint32_t child = 0; child < tree.counts[node]; child++) {
+		stack.push_back(tree.values[node] + child);
+	      }
+	    }
+	  }
+	  sink = total;
+	}
+	return n * source.size();
+      }});
+
+  // Parse and eval together, since a lazy parse leaves work for eval.
+  for (size_t threshold : {size_t(0), size_t(64)}) {
+    std::string name = threshold ? "/parse+eval(lazy)" : "/parse+eval";
+    benchmarks.push_back({corpus + name, [source, threshold](size_t n, Timer &) {
+	  for (size_t i = 0; i < n; i++) {
+	    Interpreter interpreter;
+	    interpreter.setLazyParsing(threshold);
+	    interpreter.parse(source.data(), source.size());
+	    sink = interpreter.eval().getType();
+	  }
+	  return n * source.size();
+	}});
+  }
+}
+
+/*
+ * Parse-only benchmarks for nesting that eval can't handle yet.
+ */
+void add_nesting(std::vector<Benchmark> & benchmarks, const std::string & corpus,
+		 const std::string & text) {
+  std::string source = text;
+
+  std::stringstream stream(source);
+  std::list<token::Token> tokens = token::tokenize(stream);
+  benchmarks.push_back({corpus + "/parse_tokens", [source, tokens](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  sink = parse_tokens(tokens).getChildCount();
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/Interpreter::parse", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  Interpreter interpreter;
+	  sink = interpreter.parse(source.data(), source.size());
+	}
+	return n * source.size();
+      }});
+}
+
+/*
+ * Benchmarks for input with syntax errors, which only the recovering
+ * parser gets all the way through.
+ */
+void add_recovery(std::vector<Benchmark> & benchmarks, const std::string & corpus,
+		  const std::string & text) {
+  std::string source = text;
+
+  benchmarks.push_back({corpus + "/parse_text(diagnostics)", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  std::vector<Diagnostic> diagnostics;
+	  sink = parse_text(source.data(), source.size(), diagnostics).getChildCount();
+	  sink += diagnostics.size();
+	}
+	return n * source.size();
+      }});
+
+  benchmarks.push_back({corpus + "/Interpreter::parse", [source](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  Interpreter interpreter;
+	  sink = interpreter.parse(source.data(), source.size());
+	  sink += interpreter.getDiagnostics().size();
+	}
+	return n * source.size();
+      }});
+}
+
+int main(int argc, char * argv[]) {
+  Options options;
+  options.tsv = false;
+  options.min_time = 0.2;
+  for (int i = 1; i < argc; i++) {
+    std::string argument = argv[i];
+    if (argument == "--tsv") {
+      options.tsv = true;
+    } else if ((argument == "--filter") && (i + 1 < argc)) {
+      options.filter = argv[++i];
+    } else if ((argument == "--min-time") && (i + 1 < argc)) {
+      options.min_time = std::atof(argv[++i]);
+    } else {
+      std::fprintf(stderr, "usage: %s [--tsv] [--filter TEXT] [--min-time SECONDS]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::vector<Benchmark> benchmarks;
+  add_pipeline(benchmarks, "deep", deep_corpus(500));
+  // Three times as deep, to check eval time grows linearly.
+  add_pipeline(benchmarks, "deep_1500", deep_corpus(1500));
+  add_pipeline(benchmarks, "wide", wide_corpus(5000));
+  add_pipeline(benchmarks, "numeric", numeric_corpus(5000));
+  add_pipeline(benchmarks, "symbol", symbol_corpus(5000));
+  generate::Options generated;
+  generated.forms = 5000;
+  add_pipeline(benchmarks, "generated", generate::program(generated));
+  generate::Options branchy;
+  branchy.forms = 5000;
+  branchy.depth = 6;
+  branchy.if_density = 0.6;
+  add_pipeline(benchmarks, "branchy", generate::program(branchy));
+  add_recovery(benchmarks, "broken", broken_corpus(5000));
+  add_nesting(benchmarks, "nested_100k", nested_corpus(100000));
+  add_nesting(benchmarks, "nested_1m", nested_corpus(1000000));
+
+  // The same short text parsed over and over, with and without a
+  // cache.
+  std::string query = "(begin (define rate 1.05) (* rate (+ 100 (* 2 rate)) 3))";
+  benchmarks.push_back({"query/Interpreter::parse", [query](size_t n, Timer &) {
+	Interpreter interpreter;
+	for (size_t i = 0; i < n; i++) {
+	  sink = interpreter.parse(query.data(), query.size());
+	}
+	return n * query.size();
+      }});
+  benchmarks.push_back({"query/Interpreter::parse(cached)", [query](size_t n, Timer &) {
+	cache::ParseCache cache(64);
+	Interpreter interpreter;
+	interpreter.setParseCache(&cache);
+	for (size_t i = 0; i < n; i++) {
+	  sink = interpreter.parse(query.data(), query.size());
+	}
+	return n * query.size();
+      }});
+
+  std::vector<std::string> numbers = number_corpus();
+  size_t number_bytes = 0;
+  for (auto & text : numbers) {
+    number_bytes += text.size();
+  }
+  benchmarks.push_back({"number/stringstream", [numbers, number_bytes](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  std::stringstream stream(numbers[i % numbers.size()]);
+	  double value;
+	  stream >> value;
+	  sink = value;
+	}
+	return n * number_bytes / numbers.size();
+      }});
+  benchmarks.push_back({"number/number::parse", [numbers, number_bytes](size_t n, Timer &) {
+	for (size_t i = 0; i < n; i++) {
+	  const std::string & text = numbers[i % numbers.size()];
+	  double value = 0;
+	  number::parse(text.data(), text.size(), value);
+	  sink = value;
+	}
+	return n * number_bytes / numbers.size();
+      }});
+
+  report_header(options);
+  for (auto & benchmark : benchmarks) {
+    run(benchmark, options);
+  }
+
+  // How much hash consing shares in each corpus.
+  if (!options.tsv) {
+    std::vector<std::pair<std::string, std::string>> corpora = {
+      {"deep", deep_corpus(500)}, {"wide", wide_corpus(5000)},
+      {"numeric", numeric_corpus(5000)}, {"symbol", symbol_corpus(5000)},
+      {"generated", generate::program(generated)}
+    };
+    std::printf("\n%-44s %12s %14s %12s\n", "parser stats", "lists", "unique lists", "dedupe");
+    for (auto & corpus : corpora) {
+      if (corpus.first.find(options.filter) == std::string::npos) {
+	continue;
+      }
+      Interpreter interpreter;
+      interpreter.setHashConsing(true);
+      interpreter.parse(corpus.second.data(), corpus.second.size());
+      ParseStats stats = interpreter.getParseStats();
+      std::printf("%-44s %12zu %14zu %11.1f%%\n", corpus.first.c_str(), stats.lists,
+		  stats.unique_lists, stats.getDedupeRatio() * 100);
+    }
+
+    // Everything an Expression tree allocates, per node, against the
+    // arrays of the flat layout. The tree is rebuilt by flat::expand,
+    // which sizes every list exactly and allocates nothing else.
+    std::printf("\n%-44s %12s %14s %12s\n", "node size", "nodes", "tree B/node", "flat B/node");
+    for (auto & corpus : corpora) {
+      if (corpus.first.find(options.filter) == std::string::npos) {
+	continue;
+      }
+      flat::Tree tree = flat::flatten(parse_text(corpus.second.data(), corpus.second.size()));
+      uint64_t before = allocated_bytes.load();
+      Expression program = flat::expand(tree, 0);
+      double tree_bytes = sizeof(Expression) + allocated_bytes.load() - before;
+      std::printf("%-44s %12zu %14.1f %12.1f\n", corpus.first.c_str(), tree.size(),
+		  tree_bytes / tree.size(), double(tree.getBytes()) / tree.size());
+    }
+  }
+  return 0;
+}
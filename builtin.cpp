@@ -0,0 +1,18 @@
+#include "builtin.hpp"
+
+#include <cstring>
+#include <cstddef>
+
+namespace builtin {
+
+  Opcode lookup(const char * text, size_t length) {
+    for (size_t i = 1; i < OPCODE_COUNT; i++) {
+      const char * name = builtins[i].name;
+      if ((std::strlen(name) == length) && (std::memcmp(name, text, length) == 0)) {
+	return builtins[i].opcode;
+      }
+    }
+    return NO_OPCODE;
+  }
+
+}
@@ -0,0 +1,85 @@
+#include <cstddef>
+#include <cstdint>
+
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+namespace builtin {
+
+  /*
+   * The builtin forms, numbered so they can index a table. NO_OPCODE
+   * is any symbol that isn't reserved.
+   */
+  enum Opcode : uint8_t {
+    NO_OPCODE, NOT, AND, OR, LESS, LESS_EQUAL, GREATER, GREATER_EQUAL, EQUAL,
+    SUM, DIFFERENCE, PRODUCT, RATIO, DEFINE, BEGIN, IF, OPCODE_COUNT
+  };
+
+  /*
+   * What a builtin needs its arguments to evaluate to. DEFINE's first
+   * argument is a symbol that isn't evaluated, so it's checked apart.
+   */
+  enum Arguments : uint8_t {
+    ANY, BOOLS, NUMBERS
+  };
+
+  /*
+   * A max_args that means there's no limit.
+   */
+  const uint8_t VARIADIC = UINT8_MAX;
+
+  /*
+   * A builtin: the name it's called by, how many arguments it takes
+   * (not counting the symbol heading the form), and what they have to
+   * be. The evaluators keep their own handlers, indexed by opcode, so
+   * this layer doesn't depend on them.
+   */
+  struct Builtin {
+    const char * name;
+    Opcode opcode;
+    uint8_t min_args;
+    uint8_t max_args;
+    Arguments arguments;
+  };
+
+  /*
+   * Every builtin, indexed by opcode.
+   */
+  constexpr Builtin builtins[OPCODE_COUNT] = {
+    {"", NO_OPCODE, 0, 0, ANY},
+    {"not", NOT, 1, 1, BOOLS},
+    {"and", AND, 2, VARIADIC, BOOLS},
+    {"or", OR, 2, VARIADIC, BOOLS},
+    {"<", LESS, 2, 2, NUMBERS},
+    {"<=", LESS_EQUAL, 2, 2, NUMBERS},
+    {">", GREATER, 2, 2, NUMBERS},
+    {">=", GREATER_EQUAL, 2, 2, NUMBERS},
+    {"=", EQUAL, 2, 2, NUMBERS},
+    {"+", SUM, 2, VARIADIC, NUMBERS},
+    {"-", DIFFERENCE, 1, 2, NUMBERS},
+    {"*", PRODUCT, 2, VARIADIC, NUMBERS},
+    {"/", RATIO, 2, 2, NUMBERS},
+    {"define", DEFINE, 2, 2, ANY},
+    {"begin", BEGIN, 1, VARIADIC, ANY},
+    {"if", IF, 3, 3, ANY}
+  };
+
+  /*
+   * Return the opcode a name calls, or NO_OPCODE. Symbols are resolved
+   * once, when they're interned, so this isn't on the eval path.
+   */
+  Opcode lookup(const char * text, size_t length);
+
+  /*
+   * Return true if a form with argument_count arguments is the right
+   * size for the builtin. It's checked on every call, so it's inline.
+   */
+  inline bool accepts(Opcode opcode, size_t argument_count) {
+    const Builtin & form = builtins[opcode];
+    return (argument_count >= form.min_args) &&
+      ((form.max_args == VARIADIC) || (argument_count <= form.max_args));
+  }
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include "cache.hpp"
+
+#include <list>
+#include <string>
+#include <cstring>
+#include <unordered_map>
+
+#include "expression.hpp"
+#include "fnv.hpp"
+
+namespace cache {
+
+  ParseCache::ParseCache(size_t capacity) {
+    this->capacity = capacity;
+    this->hits = 0;
+    this->misses = 0;
+  }
+
+  bool ParseCache::lookup(const char * data, size_t size, Expression & program, size_t & depth) {
+    std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator found =
+      index.find(fnv::hash(data, size));
+    if ((found == index.end()) || (found->second->text.size() != size) ||
+	(std::memcmp(found->second->text.data(), data, size) != 0)) {
+      misses++;
+      return false;
+    }
+    hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    program = found->second->program;
+    depth = found->second->depth;
+    return true;
+  }
+
+  void ParseCache::insert(const char * data, size_t size, const Expression & program, size_t depth) {
+    if (capacity == 0) {
+      return;
+    }
+    uint64_t hash = fnv::hash(data, size);
+    std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator found = index.find(hash);
+    if (found != index.end()) {
+      // Either the same text or a text whose hash collides with it.
+      // The newer one wins.
+      entries.erase(found->second);
+      index.erase(found);
+    }
+    Entry entry;
+    entry.hash = hash;
+    entry.text.assign(data, size);
+    // Trees handed out by the cache may end up on other threads, so
+    // none of their lists can be left to parse later.
+    force_lazy(program);
+    entry.program = program;
+    entry.depth = depth;
+    entries.push_front(std::move(entry));
+    index[hash] = entries.begin();
+    trim();
+  }
+
+  void ParseCache::trim() {
+    while (entries.size() > capacity) {
+      index.erase(entries.back().hash);
+      entries.pop_back();
+    }
+  }
+
+  void ParseCache::setCapacity(size_t capacity) {
+    this->capacity = capacity;
+    trim();
+  }
+
+  size_t ParseCache::getCapacity() const {
+    return capacity;
+  }
+
+  size_t ParseCache::getSize() const {
+    return entries.size();
+  }
+
+  uint64_t ParseCache::getHits() const {
+    return hits;
+  }
+
+  uint64_t ParseCache::getMisses() const {
+    return misses;
+  }
+
+  void ParseCache::clear() {
+    entries.clear();
+    index.clear();
+    hits = 0;
+    misses = 0;
+  }
+
+}
@@ -0,0 +1,52 @@
+#include <list>
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#include "expression.hpp"
+
+#ifndef CACHE_H
+#define CACHE_H
+
+namespace cache {
+
+  /*
+   * Remembers the programs parsed from recent source texts, so text
+   * that comes in again skips lexing and parsing. Entries are found by
+   * a hash of the text and the text is compared before an entry is
+   * used. Once there are capacity entries, the least recently used one
+   * makes way for a new one. A capacity of 0 keeps nothing. Lazy lists
+   * are parsed as a program goes in, so the trees it hands out never
+   * change. The cache itself isn't safe to share between threads.
+   */
+  class ParseCache {
+  public:
+    ParseCache(size_t capacity);
+    bool lookup(const char * data, size_t size, Expression & program, size_t & depth);
+    void insert(const char * data, size_t size, const Expression & program, size_t depth);
+    void setCapacity(size_t capacity);
+    size_t getCapacity() const;
+    size_t getSize() const;
+    uint64_t getHits() const;
+    uint64_t getMisses() const;
+    void clear();
+  private:
+    struct Entry {
+      uint64_t hash;
+      std::string text;
+      Expression program;
+      size_t depth;
+    };
+    void trim();
+    // Most recently used first.
+    std::list<Entry> entries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    size_t capacity;
+    uint64_t hits;
+    uint64_t misses;
+  };
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+#include "compiled.hpp"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+
+#include "expression.hpp"
+#include "flat.hpp"
+#include "symbol.hpp"
+#include "fnv.hpp"
+
+namespace compiled {
+
+  bool is_compiled(const char * data, size_t size) {
+    return (size >= sizeof(Header)) && (std::memcmp(data, MAGIC, sizeof(MAGIC)) == 0);
+  }
+
+  /*
+   * The hash of a .vtc payload. It's FNV-1a taken a 64 bit word at a
+   * time, with the high bits folded back down after each word so they
+   * still reach the rest, and then FNV-1a over the bytes left over.
+   */
+  static uint64_t checksum(const char * data, size_t size) {
+    uint64_t value = fnv::OFFSET_BASIS;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+      uint64_t word;
+      std::memcpy(&word, data + i, sizeof(word));
+      value ^= word;
+      value *= fnv::PRIME;
+      value ^= value >> 32;
+    }
+    for (; i < size; i++) {
+      value ^= static_cast<unsigned char>(data[i]);
+      value *= fnv::PRIME;
+    }
+    return value;
+  }
+
+  template <typename T>
+  static void write_array(std::string & output, const std::vector<T> & array) {
+    output.append(reinterpret_cast<const char *>(array.data()), array.size() * sizeof(T));
+  }
+
+  template <typename T>
+  static void read_array(const char * & cursor, size_t count, std::vector<T> & array) {
+    array.resize(count);
+    std::memcpy(array.data(), cursor, count * sizeof(T));
+    cursor += count * sizeof(T);
+  }
+
+  bool compile(const char * source, size_t size, std::string & output) {
+    if (size > UINT32_MAX) {
+      return false;
+    }
+    // Check the script the same way Interpreter::parse does, so only
+    // programs it would accept get written out.
+    Expression program;
+    size_t depth = 0;
+    try {
+      program = parse_text(source, size, &depth);
+      if (program.getChildCount() == 0) {
+	return false;
+      }
+    } catch (InvalidTokenException & e) {
+      return false;
+    }
+
+    flat::Tree tree = flat::flatten(program);
+    std::vector<uint32_t> lengths;
+    std::string strings;
+    for (auto const & symbol : tree.symbols) {
+      lengths.push_back(symbol.size());
+      strings += symbol;
+    }
+    std::string payload;
+    write_array(payload, tree.numbers);
+    write_array(payload, tree.offsets);
+    write_array(payload, tree.values);
+    write_array(payload, tree.counts);
+    write_array(payload, lengths);
+    write_array(payload, tree.types);
+    payload += strings;
+
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.node_count = tree.size();
+    header.number_count = tree.numbers.size();
+    header.symbol_count = tree.symbols.size();
+    header.string_size = strings.size();
+    header.depth = depth;
+    header.reserved = 0;
+    header.source_hash = fnv::hash(source, size);
+    header.payload_hash = checksum(payload.data(), payload.size());
+    output.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    output += payload;
+    return true;
+  }
+
+  /*
+   * Read and check the header. The sizes it gives have to add up to
+   * the size of the data.
+   */
+  static bool read_header(const char * data, size_t size, Header & header) {
+    if (!is_compiled(data, size)) {
+      return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (header.version != VERSION) {
+      return false;
+    }
+    uint64_t expected = sizeof(Header) + static_cast<uint64_t>(header.number_count) * sizeof(double) +
+      static_cast<uint64_t>(header.node_count) * (3 * sizeof(uint32_t) + sizeof(uint8_t)) +
+      static_cast<uint64_t>(header.symbol_count) * sizeof(uint32_t) + header.string_size;
+    return expected == size;
+  }
+
+  /*
+   * Check that every node of a loaded tree points somewhere real. A
+   * list's children always come after it, so eval can't loop, and the
+   * nesting of every list is known by the time it's reached. depth is
+   * set to the deepest, which is what eval's depth guard goes by.
+   */
+  static bool check_nodes(const flat::Tree & tree, size_t & depth) {
+    if (tree.empty() || (tree.types[0] != LIST)) {
+      return false;
+    }
+    // How deeply each list is nested, or 0 if no list holds it.
+    std::vector<uint32_t> levels(tree.size(), 0);
+    levels[0] = 1;
+    depth = 0;
+    for (size_t i = 0; i < tree.size(); i++) {
+      uint32_t value = tree.values[i];
+      switch (tree.types[i]) {
+      case NONE:
+	if (value != 0) {
+	  return false;
+	}
+	break;
+      case BOOL:
+	if (value > 1) {
+	  return false;
+	}
+	break;
+      case NUMBER:
+	if (value >= tree.numbers.size()) {
+	  return false;
+	}
+	break;
+      case SYMBOL:
+	if (value >= tree.symbols.size()) {
+	  return false;
+	}
+	break;
+      case LIST:
+	if ((value <= i) || (static_cast<uint64_t>(value) + tree.counts[i] > tree.size())) {
+	  return false;
+	}
+	if (levels[i] > depth) {
+	  depth = levels[i];
+	}
+	for (uint32_t child = value; child < value + tree.counts[i]; child++) {
+	  if (levels[child] < levels[i] + 1) {
+	    levels[child] = levels[i] + 1;
+	  }
+	}
+	break;
+      default:
+	return false;
+      }
+    }
+    return true;
+  }
+
+  bool load(const char * data, size_t size, flat::Tree & program, size_t & depth) {
+    Header header;
+    if (!read_header(data, size, header)) {
+      return false;
+    }
+    const char * cursor = data + sizeof(Header);
+    if (checksum(cursor, size - sizeof(Header)) != header.payload_hash) {
+      return false;
+    }
+    flat::Tree tree;
+    std::vector<uint32_t> lengths;
+    read_array(cursor, header.number_count, tree.numbers);
+    read_array(cursor, header.node_count, tree.offsets);
+    read_array(cursor, header.node_count, tree.values);
+    read_array(cursor, header.node_count, tree.counts);
+    read_array(cursor, header.symbol_count, lengths);
+    read_array(cursor, header.node_count, tree.types);
+
+    // The symbols are interned again, since ids and opcodes are only
+    // good for the process that handed them out.
+    uint64_t start = 0;
+    for (auto length : lengths) {
+      if ((length == 0) || (start + length > header.string_size)) {
+	return false;
+      }
+      const symbol::Symbol * symbol = symbol::intern(cursor + start, length);
+      tree.symbols.push_back(symbol->name);
+      tree.ids.push_back(symbol->id);
+      tree.forms.push_back(symbol->opcode);
+      start += length;
+    }
+    // The header's depth has to be the real one, or eval's depth guard
+    // could be talked out of stopping a tree too deep to walk.
+    size_t nesting = 0;
+    if ((start != header.string_size) || !check_nodes(tree, nesting) ||
+	(nesting != header.depth)) {
+      return false;
+    }
+    program = std::move(tree);
+    depth = nesting;
+    return true;
+  }
+
+  bool matches(const char * data, size_t size, const char * source, size_t source_size) {
+    Header header;
+    if (!read_header(data, size, header)) {
+      return false;
+    }
+    return header.source_hash == fnv::hash(source, source_size);
+  }
+
+}
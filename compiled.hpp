@@ -0,0 +1,73 @@
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#include "expression.hpp"
+#include "flat.hpp"
+
+#ifndef COMPILED_H
+#define COMPILED_H
+
+namespace compiled {
+
+  /*
+   * The .vtc format holds a program already laid out flat (see
+   * flat.hpp), so it can be run without lexing, parsing or building a
+   * tree. It's a header followed by the arrays of a flat::Tree, one
+   * after the other, and then the text of its symbols. Every array
+   * starts on a multiple of its element size. Nothing in it is a
+   * pointer, so loading is copying the arrays out and interning the
+   * symbols. Everything is little-endian. A file written with another
+   * byte order or another VERSION fails the version check, and a
+   * damaged one fails the payload hash.
+   */
+  const char MAGIC[4] = {'\x7f', 'V', 'T', 'C'};
+  const uint32_t VERSION = 2;
+
+  /*
+   * The numbers pool comes first, then offsets, values and counts
+   * (node_count each), symbol lengths (symbol_count), types
+   * (node_count bytes) and symbol text (string_size bytes). depth is
+   * how deeply the program's lists are nested.
+   */
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t node_count;
+    uint32_t number_count;
+    uint32_t symbol_count;
+    uint32_t string_size;
+    uint32_t depth;
+    uint32_t reserved;
+    uint64_t source_hash;
+    uint64_t payload_hash;
+  };
+
+  /*
+   * Return true if the data starts like a .vtc file.
+   */
+  bool is_compiled(const char * data, size_t size);
+
+  /*
+   * Compile a script into the .vtc format and append it to output. It
+   * returns false, leaving output alone, if the script doesn't parse
+   * into a program Interpreter::parse would accept.
+   */
+  bool compile(const char * source, size_t size, std::string & output);
+
+  /*
+   * Load the program in a .vtc file into a flat tree, ready for
+   * flat::eval. depth is set to how deeply its lists are nested. It
+   * returns false if the header or the payload don't check out.
+   */
+  bool load(const char * data, size_t size, flat::Tree & program, size_t & depth);
+
+  /*
+   * Return true if the .vtc file was compiled from exactly this
+   * source. A cache whose source changed since is stale.
+   */
+  bool matches(const char * data, size_t size, const char * source, size_t source_size);
+
+}
+
+#endif
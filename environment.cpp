@@ -1,30 +1,82 @@
 #include "environment.hpp"
 
-#include <map>
+#include <vector>
 #include <exception>
+#include <utility>
+#include <algorithm>
 
 #include "expression.hpp"
+#include "symbol.hpp"
 
 namespace environment {
 
-  Expression & Environment::get(const Symbol symbol) {
-    if (map.find(symbol) != map.end()) {
-      return map[symbol];
-    } else {
+  Environment::Environment() {
+    this->used = 0;
+  }
+
+  /*
+   * Return the slot that holds id, or the empty slot it would go in.
+   * Ids are handed out in order, so the low bits spread them well.
+   */
+  size_t Environment::find(symbol::SymbolId id) const {
+    size_t mask = ids.size() - 1;
+    size_t slot = id & mask;
+    while ((ids[slot] != id) && (ids[slot] != symbol::NO_SYMBOL)) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  Expression & Environment::get(symbol::SymbolId id) {
+    if (!ids.empty()) {
+      size_t slot = find(id);
+      if (ids[slot] == id) {
+	return values[slot];
+      }
+    }
+    throw LookupException(symbol::name(id));
+  }
+
+  Expression & Environment::get(const Symbol & symbol) {
+    const symbol::Symbol * interned = symbol::lookup(symbol);
+    if (interned == nullptr) {
       throw LookupException(symbol);
     }
+    return get(interned->id);
   }
 
-  void Environment::set(const Symbol symbol, Expression expr) {
-    if (map.find(symbol) == map.end()) {
-      map[symbol] = expr;
-    } else {
-      throw SetException(symbol);
+  void Environment::set(symbol::SymbolId id, Expression expr) {
+    if (2 * (used + 1) > ids.size()) {
+      std::vector<symbol::SymbolId> old_ids(std::max<size_t>(16, 2 * ids.size()),
+					    symbol::NO_SYMBOL);
+      std::vector<Expression> old_values(old_ids.size());
+      old_ids.swap(ids);
+      old_values.swap(values);
+      for (size_t i = 0; i < old_ids.size(); i++) {
+	if (old_ids[i] != symbol::NO_SYMBOL) {
+	  size_t slot = find(old_ids[i]);
+	  ids[slot] = old_ids[i];
+	  values[slot] = std::move(old_values[i]);
+	}
+      }
+    }
+    size_t slot = find(id);
+    if (ids[slot] == id) {
+      throw SetException(symbol::name(id));
     }
+    ids[slot] = id;
+    values[slot] = std::move(expr);
+    used++;
+  }
+
+  void Environment::set(const Symbol & symbol, Expression expr) {
+    set(symbol::intern(symbol)->id, std::move(expr));
   }
 
   void Environment::reset() {
-    map.clear();
+    ids.clear();
+    values.clear();
+    used = 0;
   }
 
   Symbol LookupException::getSymbol() {
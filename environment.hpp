@@ -1,9 +1,10 @@
-#include <map>
+#include <vector>
 #include <string>
 #include <exception>
 #include <stdexcept>
 
 #include "expression.hpp"
+#include "symbol.hpp"
 
 #ifndef ENVIRONMENT_H
 #define ENVIRONMENT_H
@@ -12,17 +13,29 @@ namespace environment {
 
   typedef std::string Symbol;
 
-/*
- * Represents a mapping between the identifiers in a variable and the
- * variable's value. This is a global environment and has no support
- * for local scoping.
- */
+ /*
+  * Represents a mapping between the identifiers in a variable and the
+  * variable's value. This is a global environment and has no support
+  * for local scoping. Variables are kept in a small open addressing
+  * table keyed by their interned symbol id (see symbol.hpp), so it only
+  * grows with the variables defined in it. get by name looks the name
+  * up without interning it, so asking for names that were never
+  * defined doesn't grow the symbol table.
+  */
  class Environment {
  private:
-   std::map<Symbol, Expression> map;
+   size_t find(symbol::SymbolId id) const;
+   // A power of two number of slots, kept at most half full. An empty
+   // slot's id is NO_SYMBOL.
+   std::vector<symbol::SymbolId> ids;
+   std::vector<Expression> values;
+   size_t used;
  public:
-   Expression & get(const Symbol symbol);
-   void set(const Symbol symbol, Expression expr);
+   Environment();
+   Expression & get(symbol::SymbolId id);
+   Expression & get(const Symbol & symbol);
+   void set(symbol::SymbolId id, Expression expr);
+   void set(const Symbol & symbol, Expression expr);
    void reset();
  };
 
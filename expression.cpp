@@ -1,11 +1,19 @@
 #include <sstream>
 #include <cctype>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 
 #include "expression.hpp"
 
 #include "tokenize.hpp"
+#include "number.hpp"
+#include "scan.hpp"
 
-bool match_open(token::Token token) {
+bool match_open(const token::Token & token) {
   bool correct_type = token.getType() == token::OPEN_PAREN;
   bool correct_string = token.getText() == "(";
   if (correct_type && !correct_string) {
@@ -17,7 +25,7 @@ bool match_open(token::Token token) {
   return correct_type && correct_string;
 }
 
-bool match_close(token::Token token) {
+bool match_close(const token::Token & token) {
   bool correct_type = token.getType() == token::CLOSE_PAREN;
   bool correct_string = token.getText() == ")";
   if (correct_type && !correct_string) {
@@ -29,7 +37,10 @@ bool match_close(token::Token token) {
   return correct_type && correct_string;
 }
 
-bool match_bool(token::Token token) {
+bool match_bool(const token::Token & token) {
+  if (token.getType() == token::BOOL) {
+    return true;
+  }
   bool correct_type = token.getType() == token::ATOM;
   bool true_string  = token.getText() == "True";
   bool false_string = token.getText() == "False";
@@ -39,7 +50,10 @@ bool match_bool(token::Token token) {
   return correct_type && (true_string || false_string);
 }
 
-bool match_none(token::Token token) {
+bool match_none(const token::Token & token) {
+  if (token.getType() == token::NONE) {
+    return true;
+  }
   bool correct_type = token.getType() == token::ATOM;
   bool none_string = token.getText() == "None";
   if (!correct_type && none_string) {
@@ -48,61 +62,18 @@ bool match_none(token::Token token) {
   return correct_type && none_string;
 }
 
-bool match_number(token::Token token) {
-  // TODO! Make this less of a hack.
-  if (token.getText() == "+" or token.getText() == "-") {
-    return false;
-  }
-  bool first_char = true;
-  bool hit_dot = false;
-  bool hit_e = false;
-  bool number_after_e = false;
-  for (auto character : token.getText()) {
-    switch (character) {
-    case '+':
-    case '-':
-      if (!first_char) {
-	return false;
-      }
-      break;
-    case '.':
-      if (first_char || hit_dot || hit_e) {
-	return false;
-      }
-      break;
-    case 'e':
-      if (first_char || hit_e) {
-	return false;
-      }
-    case '0':
-    case '1':
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
-      if (hit_e) {
-	number_after_e = true;
-      }
-      break;
-    default:
-      return false;
-    }
-    first_char = false;
-  }
-
-
-  if (hit_e) {
-    return number_after_e;
-  } else {
+bool match_number(const token::Token & token) {
+  if (token.getType() == token::NUMBER) {
     return true;
   }
+  const std::string & text = token.getText();
+  return token::is_number(text.data(), text.size());
 }
 
-bool match_symbol(token::Token token) {
+bool match_symbol(const token::Token & token) {
+  if (token.getType() == token::SYMBOL) {
+    return true;
+  }
   bool not_number = !match_number(token);
   bool not_none = !match_none(token);
   bool not_bool = !match_bool(token);
@@ -111,8 +82,24 @@ bool match_symbol(token::Token token) {
 }
 
 
+/*
+ * What a list points to. Copies of the list share it, and the last one
+ * to go frees it. A lazy list has a span and no children until it's
+ * first looked at.
+ */
+struct Expression::ListBody {
+  ListBody() : references(1) {}
+  std::atomic<uint32_t> references;
+  std::vector<Expression> children;
+  std::shared_ptr<LazySpan> lazy;
+};
+
+static_assert(sizeof(Expression) <= 16, "an Expression should fit in 16 bytes");
+
 Expression::Expression() {
   this->type = NONE;
+  this->offset = 0;
+  this->number_value = 0;
 }
 
 bool Expression::operator==(const Expression & other) const noexcept {
@@ -132,29 +119,188 @@ bool Expression::operator==(const Expression & other) const noexcept {
     return true; // There's only one NONE.
   }
   if (type == LIST) {
-    return children == other.children;
+    if (body == other.body) {
+      return true;
+    }
+    return list() == other.list();
   }
   return false;
 }
 
 Expression::Expression(double value) {
   this->type = NUMBER;
+  this->offset = 0;
   this->number_value = value;
 }
 
 Expression::Expression(bool value) {
   this->type = BOOL;
+  this->offset = 0;
+  this->number_value = 0;
   this->bool_value = value;
 }
 
-Expression::Expression(const std::string value) {
+Expression::Expression(const std::string & value) {
+  this->type = SYMBOL;
+  this->offset = 0;
+  this->symbol_value = symbol::intern(value);
+}
+
+Expression::Expression(const symbol::Symbol * symbol) {
   this->type = SYMBOL;
-  this->symbol_value = value;
+  this->offset = 0;
+  this->symbol_value = symbol;
+}
+
+Expression::Expression(std::vector<Expression> children) {
+  this->type = LIST;
+  this->offset = 0;
+  this->body = new ListBody();
+  this->body->children = std::move(children);
 }
 
-Expression::Expression(const std::vector<Expression> children) {
+Expression::Expression(std::shared_ptr<LazySpan> span, uint32_t offset) {
   this->type = LIST;
-  this->children = children;
+  this->offset = offset;
+  this->body = new ListBody();
+  this->body->lazy = std::move(span);
+}
+
+void Expression::release() noexcept {
+  if ((type != LIST) || (body == nullptr)) {
+    return;
+  }
+  if (body->references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  // Freeing children one by one would recurse once per level, so every
+  // body this was the last owner of goes onto a worklist instead, and
+  // is freed once nothing under it is left.
+  std::vector<ListBody *> pending;
+  ListBody * last = body;
+  while (true) {
+    for (auto & child : last->children) {
+      if ((child.type == LIST) && (child.body != nullptr)) {
+	if (child.body->references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+	  pending.push_back(child.body);
+	}
+	child.body = nullptr;
+      }
+    }
+    delete last;
+    if (pending.empty()) {
+      break;
+    }
+    last = pending.back();
+    pending.pop_back();
+  }
+}
+
+Expression::~Expression() {
+  release();
+}
+
+HashConser::HashConser() {
+  this->lists = 0;
+}
+
+Expression HashConser::make_list(std::vector<Expression> children, uint32_t offset) {
+  lists++;
+  uint64_t key = hash(children);
+  auto range = table.equal_range(key);
+  for (auto entry = range.first; entry != range.second; ++entry) {
+    if (same(entry->second.body->children, children)) {
+      Expression list = entry->second;
+      list.offset = offset;
+      return list;
+    }
+  }
+  Expression list(std::move(children));
+  list.offset = offset;
+  table.insert(std::make_pair(key, list));
+  return list;
+}
+
+ParseStats HashConser::getStats() const {
+  ParseStats stats;
+  stats.lists = lists;
+  stats.unique_lists = table.size();
+  return stats;
+}
+
+double ParseStats::getDedupeRatio() const {
+  if (lists == 0) {
+    return 0;
+  }
+  return 1 - (double) unique_lists / lists;
+}
+
+uint64_t HashConser::hash(const std::vector<Expression> & children) {
+  // FNV-1a over one word per child.
+  uint64_t value = 14695981039346656037ull;
+  for (auto const & child : children) {
+    uint64_t word = child.type;
+    switch (child.type) {
+    case BOOL:
+      word ^= child.bool_value ? 0x100 : 0;
+      break;
+    case NUMBER:
+      {
+	uint64_t bits;
+	std::memcpy(&bits, &child.number_value, sizeof(bits));
+	word ^= bits;
+	break;
+      }
+    case SYMBOL:
+      word ^= reinterpret_cast<uintptr_t>(child.symbol_value);
+      break;
+    case LIST:
+      word ^= reinterpret_cast<uintptr_t>(child.body);
+      break;
+    default:
+      break;
+    }
+    value = (value ^ word) * 1099511628211ull;
+  }
+  return value;
+}
+
+bool HashConser::same(const std::vector<Expression> & left, const std::vector<Expression> & right) {
+  if (left.size() != right.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < left.size(); i++) {
+    const Expression & a = left[i];
+    const Expression & b = right[i];
+    if (a.type != b.type) {
+      return false;
+    }
+    switch (a.type) {
+    case BOOL:
+      if (a.bool_value != b.bool_value) {
+	return false;
+      }
+      break;
+    case NUMBER:
+      if (std::memcmp(&a.number_value, &b.number_value, sizeof(double)) != 0) {
+	return false;
+      }
+      break;
+    case SYMBOL:
+      if (a.symbol_value != b.symbol_value) {
+	return false;
+      }
+      break;
+    case LIST:
+      if (a.body != b.body) {
+	return false;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  return true;
 }
 
 const char * InvalidTokenException::what () const noexcept {
@@ -164,83 +310,693 @@ const char * InvalidTokenException::what () const noexcept {
   return output.c_str();
 }
 
+uint32_t InvalidTokenException::getOffset() const {
+  return offset;
+}
+
 AtomType Expression::getType() const {
   return type;
 }
 
-Expression parse_tokens_iter(std::list<token::Token> & tokens) {
-  std::vector<Expression> top;
-  while (!tokens.empty()) {
-    if (match_open(tokens.front())) {
-      tokens.pop_front();
-      top.push_back(parse_tokens_iter(tokens));
-    } else if (match_close(tokens.front())) {
-      tokens.pop_front();
-      if (top.size() == 0) {
-	// TODO! This should return an error if the vector is empty.
-	throw InvalidTokenException(token::Token(token::ATOM, "TODO", 0));
+/*
+ * The list parser behind both list versions of parse_tokens. It's
+ * called just after an open paren and leaves cursor at the first token
+ * past the list it returns. Unfinished lists are kept on a stack of
+ * its own, so deep nesting doesn't use up the call stack.
+ */
+static Expression parse_list(std::list<token::Token>::const_iterator & cursor,
+			     std::list<token::Token>::const_iterator end) {
+  // One vector of children per list that is still open. The list this
+  // call returns is at the bottom.
+  std::vector<std::vector<Expression>> stack(1);
+  while (cursor != end) {
+    if (match_open(*cursor)) {
+      ++cursor;
+      stack.emplace_back();
+    } else if (match_close(*cursor)) {
+      ++cursor;
+      if (stack.back().size() == 0) {
+	throw InvalidTokenException(token::Token(token::ATOM, "empty list", 0));
       }
-      return Expression(top);
+      Expression list(std::move(stack.back()));
+      stack.pop_back();
+      if (stack.empty()) {
+	return list;
+      }
+      stack.back().push_back(std::move(list));
     } else {
-      top.push_back(parse_atom(tokens.front()));
-      tokens.pop_front();
+      stack.back().push_back(parse_atom(*cursor));
+      ++cursor;
     }
   }
-  // TODO! This should return an error if the vector is empty.
-  throw InvalidTokenException(token::Token(token::ATOM, "TODO", 0));
+  throw InvalidTokenException(token::Token(token::ATOM, "missing ')'", 0));
 }
 
-Expression parse_atom(token::Token token) {
-  if (match_bool(token)) {
-    if (token.getText() == "True") {
-      return Expression(true);
-    } else if (token.getText() == "False") {
-      return Expression(false);
-    } else {
-      throw InvalidTokenException(token);
-    }
-  } else if (match_none(token)) {
+Expression parse_tokens_iter(std::list<token::Token> & tokens) {
+  std::list<token::Token>::const_iterator cursor = tokens.cbegin();
+  try {
+    Expression list = parse_list(cursor, tokens.cend());
+    tokens.erase(tokens.cbegin(), cursor);
+    return list;
+  } catch (...) {
+    tokens.erase(tokens.cbegin(), cursor);
+    throw;
+  }
+}
+
+/*
+ * Build an atom expression out of text that has already been
+ * classified. The type has to be one of the atom types.
+ */
+static Expression make_atom(token::Type type, const char * text, size_t length) {
+  switch (type) {
+  case token::BOOL:
+    return Expression(text[0] == 'T');
+  case token::NONE:
     return Expression();
-  } else if (match_number(token)) {
-    std::stringstream stream(token.getText());
-    double value;
-    stream >> value;
-    // TODO! This should check if we were actually given a
-    // double, since match_number might not be valid.
-    return Expression(value);
-  } else if (match_symbol(token)) {
-    return Expression(std::string(token.getText()));
+  case token::NUMBER:
+    {
+      double value = 0;
+      number::parse(text, length, value);
+      return Expression(value);
+    }
+  default:
+    return Expression(symbol::intern(text, length));
   }
-  throw InvalidTokenException(token);
 }
 
-Expression parse_tokens(std::list<token::Token> tokens) {
+static bool is_atom_type(token::Type type) {
+  return (type == token::NUMBER) || (type == token::BOOL) ||
+    (type == token::NONE) || (type == token::SYMBOL);
+}
+
+Expression parse_atom(const token::Token & token) {
+  const std::string & text = token.getText();
+  token::Type type = token.getType();
+  if (type == token::ATOM) {
+    type = token::classify(text.data(), text.size());
+  }
+  if (!is_atom_type(type)) {
+    throw InvalidTokenException(token);
+  }
+  return make_atom(type, text.data(), text.size());
+}
+
+Expression parse_atom(const token::TokenView & view, const char * data) {
+  if (!is_atom_type(view.type)) {
+    throw InvalidTokenException(token::to_token(view, data, 0), view.offset);
+  }
+  Expression atom = make_atom(view.type, data + view.offset, view.length);
+  atom.setOffset(view.offset);
+  return atom;
+}
+
+Expression parse_tokens(const std::list<token::Token> & tokens) {
   if (tokens.empty()) {
-    //TODO Make betterr eror message
-    throw InvalidTokenException(token::Token(token::ATOM, "Empty tokens.", 1));
+    throw InvalidTokenException(token::Token(token::ATOM, "empty program", 1));
   }
   if ((tokens.size() == 1) && (match_symbol(tokens.front()))) {
-    //TODO Make betterr eror message
-    throw InvalidTokenException(token::Token(token::ATOM, "Bare word.", 1));
+    throw InvalidTokenException(token::Token(token::ATOM, "a program can't be a lone symbol", 1));
   }
-  std::vector<Expression> top;
-  top.push_back(Expression(std::string("begin")));
+  std::list<token::Token>::const_iterator cursor = tokens.cbegin();
   Expression parse_tree;
-  if (match_open(tokens.front())) {
-    tokens.pop_front();
-    parse_tree = parse_tokens_iter(tokens);
-  } else if (match_close(tokens.front())) {
-    //TODO Make betterr eror message
-    throw InvalidTokenException(token::Token(token::ATOM, "too many tokens", 1));
+  if (match_open(*cursor)) {
+    ++cursor;
+    parse_tree = parse_list(cursor, tokens.cend());
+  } else if (match_close(*cursor)) {
+    throw InvalidTokenException(token::Token(token::ATOM, "unmatched ')'", 1));
   } else {
-    parse_tree =  parse_atom(tokens.front());
+    parse_tree =  parse_atom(*cursor);
   }
-  if (!tokens.empty()) {
-    throw InvalidTokenException(token::Token(token::ATOM, "too many tokens", 1));
+  if (cursor != tokens.cend()) {
+    throw InvalidTokenException(token::Token(token::ATOM, "more than one top-level form", 1));
   }
   return parse_tree;
 }
 
+/*
+ * Close a list, through conser if there is one.
+ */
+static Expression build_list(std::vector<Expression> & children, uint32_t offset,
+			     HashConser * conser) {
+  if (conser != nullptr) {
+    return conser->make_list(std::move(children), offset);
+  }
+  Expression list(std::move(children));
+  list.setOffset(offset);
+  return list;
+}
+
+Expression parse_tokens_iter(token::Lexer & lexer, uint32_t offset, size_t * depth,
+			     HashConser * conser) {
+  // Children and open paren offsets of every list that is still open.
+  // The list this call returns is at the bottom.
+  std::vector<std::vector<Expression>> stack(1);
+  std::vector<uint32_t> offsets(1, offset);
+  token::TokenView view;
+  while (lexer.next(view)) {
+    if (view.type == token::OPEN_PAREN) {
+      stack.emplace_back();
+      offsets.push_back(view.offset);
+      if ((depth != nullptr) && (stack.size() > *depth)) {
+	*depth = stack.size();
+      }
+    } else if (view.type == token::CLOSE_PAREN) {
+      if (stack.back().size() == 0) {
+	throw InvalidTokenException(token::Token(token::ATOM, "empty list", 0), view.offset);
+      }
+      Expression list = build_list(stack.back(), offsets.back(), conser);
+      stack.pop_back();
+      offsets.pop_back();
+      if (stack.empty()) {
+	return list;
+      }
+      stack.back().push_back(std::move(list));
+    } else {
+      stack.back().push_back(parse_atom(view, lexer.getData()));
+    }
+  }
+  std::string message = "missing ')' for the list opened at byte " + std::to_string(offsets.front());
+  throw InvalidTokenException(token::Token(token::ATOM, message, 0), lexer.getOffset());
+}
+
+Expression parse_tokens(token::Lexer & lexer, size_t * depth, HashConser * conser) {
+  if (depth != nullptr) {
+    *depth = 0;
+  }
+  token::TokenView view;
+  if (!lexer.next(view)) {
+    throw InvalidTokenException(token::Token(token::ATOM, "empty program", 1), lexer.getOffset());
+  }
+  Expression parse_tree;
+  if (view.type == token::OPEN_PAREN) {
+    if (depth != nullptr) {
+      *depth = 1;
+    }
+    parse_tree = parse_tokens_iter(lexer, view.offset, depth, conser);
+  } else if (view.type == token::CLOSE_PAREN) {
+    throw InvalidTokenException(token::Token(token::ATOM, "unmatched ')'", 1), view.offset);
+  } else {
+    bool bare_word = view.type == token::SYMBOL;
+    uint32_t start = view.offset;
+    parse_tree = parse_atom(view, lexer.getData());
+    bool more = lexer.next(view);
+    if (!more && bare_word) {
+      throw InvalidTokenException(token::Token(token::ATOM, "a program can't be a lone symbol", 1),
+				  start);
+    }
+    if (more) {
+      throw InvalidTokenException(token::Token(token::ATOM, "more than one top-level form", 1),
+				view.offset);
+    }
+    return parse_tree;
+  }
+  if (lexer.next(view)) {
+    throw InvalidTokenException(token::Token(token::ATOM, "more than one top-level form", 1),
+				view.offset);
+  }
+  return parse_tree;
+}
+
+/*
+ * Turn the text of an atom straight into an expression. The checks
+ * are the ones classify makes, but a number is parsed in the same pass
+ * that validates it. Return false if the text isn't a valid atom.
+ */
+static bool read_atom(const char * text, size_t length, uint32_t offset, Expression & atom) {
+  double value = 0;
+  if ((length == 4) && (std::memcmp(text, "True", 4) == 0)) {
+    atom = Expression(true);
+  } else if ((length == 5) && (std::memcmp(text, "False", 5) == 0)) {
+    atom = Expression(false);
+  } else if ((length == 4) && (std::memcmp(text, "None", 4) == 0)) {
+    atom = Expression();
+  } else if (number::parse(text, length, value)) {
+    atom = Expression(value);
+  } else if (!isdigit(static_cast<unsigned char>(text[0]))) {
+    atom = Expression(symbol::intern(text, length));
+  } else {
+    return false;
+  }
+  atom.setOffset(offset);
+  return true;
+}
+
+/*
+ * Check the list that starts at begin, without building anything, and
+ * return the offset just past its close paren. depth is set to how
+ * deeply it nests. Return 0 if the list has an error in it, which a
+ * real parse of it will then report. The lists inside it spanning at
+ * least threshold bytes are added to brackets, in the order they
+ * close. opens is scratch space for the open parens.
+ */
+static uint32_t skip_list(const char * data, uint32_t begin, uint32_t size, size_t threshold,
+			  std::vector<uint32_t> & opens, Brackets & brackets, size_t & depth) {
+  const char * cursor = data + begin;
+  const char * end = data + size;
+  // Whether the innermost open list has nothing in it yet.
+  bool empty = false;
+  opens.clear();
+  depth = 0;
+  while (cursor != end) {
+    switch (*cursor) {
+    case '(':
+      opens.push_back(cursor - data);
+      if (opens.size() > depth) {
+	depth = opens.size();
+      }
+      empty = true;
+      cursor++;
+      break;
+    case ')':
+      {
+	if (empty) {
+	  return 0;
+	}
+	cursor++;
+	uint32_t close = cursor - data;
+	uint32_t open = opens.back();
+	opens.pop_back();
+	if (opens.empty()) {
+	  return close;
+	}
+	if (close - open >= threshold) {
+	  brackets.push_back(std::make_pair(open, close));
+	}
+	break;
+      }
+    case ';':
+      cursor = scan::find_newline(cursor, end);
+      if (cursor != end) {
+	cursor++;
+      }
+      break;
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+      {
+	size_t lines = 0;
+	cursor = scan::skip_space(cursor, end, lines);
+	break;
+      }
+    default:
+      {
+	const char * start = cursor;
+	cursor = scan::find_delimiter(cursor, end);
+	if (token::classify(start, cursor - start) == token::ATOM) {
+	  return 0;
+	}
+	empty = false;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * Return the offset just past the close paren of the list that starts
+ * at begin, if it's shorter than threshold bytes, counting parens
+ * alone. Return 0 if it isn't, or if there's a comment in the way.
+ * It's much cheaper than skip_list, and most branches are small. The
+ * boundary is the same as skip_list's: a list of threshold bytes is
+ * lazy.
+ */
+static uint32_t find_small_close(const char * data, uint32_t begin, uint32_t size,
+				 size_t threshold) {
+  uint32_t limit = (size - begin >= threshold) ? begin + threshold - 1 : size;
+  size_t nesting = 0;
+  for (uint32_t i = begin; i < limit; i++) {
+    switch (data[i]) {
+    case '(':
+      nesting++;
+      break;
+    case ')':
+      if (--nesting == 0) {
+	return i + 1;
+      }
+      break;
+    case ';':
+      return 0;
+    default:
+      break;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Return true if a list starting now, with parent as the children of
+ * the list around it so far, is a branch of an if. Only one branch of
+ * an if runs, so those are worth leaving unparsed. Every form of a
+ * begin runs, so making them lazy would only read them twice.
+ */
+static bool lazy_position(const std::vector<Expression> & parent) {
+  return ((parent.size() == 2) || (parent.size() == 3)) &&
+    (parent.front().getOpcode() == builtin::IF);
+}
+
+/*
+ * Report a syntax error. Without a list of diagnostics to add it to,
+ * it's thrown instead.
+ */
+static void report(std::vector<Diagnostic> * diagnostics, Diagnostic::Kind kind, uint32_t offset,
+		   std::string message) {
+  if (diagnostics == nullptr) {
+    throw InvalidTokenException(token::Token(token::ATOM, message, 0), offset);
+  }
+  Diagnostic diagnostic;
+  diagnostic.kind = kind;
+  diagnostic.offset = offset;
+  diagnostic.message = std::move(message);
+  diagnostics->push_back(std::move(diagnostic));
+}
+
+/*
+ * Puts a tree together out of the parens and atoms a reader finds.
+ * Errors are thrown, unless there's a list of diagnostics to collect
+ * them in. Then it recovers and keeps going: bad atoms and empty lists
+ * are dropped, stray close parens skipped, and extra top-level forms
+ * checked and then thrown away. parse_buffer drives it from the text
+ * and parse_tokens from a lexer, so both report the same errors.
+ */
+class TreeBuilder {
+public:
+  TreeBuilder(size_t * depth, HashConser * conser, std::vector<Diagnostic> * diagnostics);
+  void open(uint32_t offset);
+  void close(uint32_t offset);
+  void atom(Expression value, uint32_t offset);
+  void bad_atom(const char * text, size_t length, uint32_t offset);
+  bool in_branch() const;
+  void add_lazy(Expression list, size_t nesting);
+  Expression finish(uint32_t size);
+private:
+  bool extra_form(uint32_t offset);
+  size_t * depth;
+  HashConser * conser;
+  std::vector<Diagnostic> * diagnostics;
+  size_t reported;
+  // The same explicit stack as parse_tokens_iter, with the top level
+  // handled here as well.
+  std::vector<std::vector<Expression>> stack;
+  std::vector<uint32_t> offsets;
+  Expression parse_tree;
+  bool done;
+  bool bare_word;
+  bool extra_forms;
+  uint32_t start_offset;
+};
+
+TreeBuilder::TreeBuilder(size_t * depth, HashConser * conser,
+			 std::vector<Diagnostic> * diagnostics) {
+  this->depth = depth;
+  this->conser = conser;
+  this->diagnostics = diagnostics;
+  this->reported = (diagnostics != nullptr) ? diagnostics->size() : 0;
+  this->done = false;
+  this->bare_word = false;
+  this->extra_forms = false;
+  this->start_offset = 0;
+  if (depth != nullptr) {
+    *depth = 0;
+  }
+}
+
+/*
+ * Report a form that starts at offset after the program is over, and
+ * return true if it is one.
+ */
+bool TreeBuilder::extra_form(uint32_t offset) {
+  if (done && stack.empty()) {
+    report(diagnostics, Diagnostic::EXTRA_FORM, offset, "more than one top-level form");
+    extra_forms = true;
+    return true;
+  }
+  return false;
+}
+
+void TreeBuilder::open(uint32_t offset) {
+  extra_form(offset);
+  stack.emplace_back();
+  offsets.push_back(offset);
+  if ((depth != nullptr) && (stack.size() > *depth)) {
+    *depth = stack.size();
+  }
+}
+
+void TreeBuilder::close(uint32_t offset) {
+  if (stack.empty()) {
+    report(diagnostics, Diagnostic::STRAY_CLOSE, offset, "unmatched ')'");
+    return;
+  }
+  if (stack.back().size() == 0) {
+    report(diagnostics, Diagnostic::EMPTY_LIST, offset, "empty list");
+    stack.pop_back();
+    offsets.pop_back();
+    done = done || stack.empty();
+    return;
+  }
+  Expression list = build_list(stack.back(), offsets.back(), conser);
+  stack.pop_back();
+  offsets.pop_back();
+  if (!stack.empty()) {
+    stack.back().push_back(std::move(list));
+  } else if (!done) {
+    parse_tree = std::move(list);
+    done = true;
+  }
+}
+
+void TreeBuilder::atom(Expression value, uint32_t offset) {
+  bool extra = extra_form(offset);
+  if (!stack.empty()) {
+    stack.back().push_back(std::move(value));
+  } else if (!extra) {
+    bare_word = value.getType() == SYMBOL;
+    start_offset = offset;
+    parse_tree = std::move(value);
+    done = true;
+  }
+}
+
+void TreeBuilder::bad_atom(const char * text, size_t length, uint32_t offset) {
+  extra_form(offset);
+  report(diagnostics, Diagnostic::BAD_ATOM, offset,
+	 "invalid atom '" + std::string(text, length) + "'");
+  done = done || stack.empty();
+}
+
+/*
+ * Return true if a list starting now would be a branch of an if.
+ */
+bool TreeBuilder::in_branch() const {
+  return !stack.empty() && lazy_position(stack.back());
+}
+
+/*
+ * Add a list that was only skipped. nesting is how deeply it nests.
+ */
+void TreeBuilder::add_lazy(Expression list, size_t nesting) {
+  stack.back().push_back(std::move(list));
+  if ((depth != nullptr) && (stack.size() + nesting > *depth)) {
+    *depth = stack.size() + nesting;
+  }
+}
+
+/*
+ * Report what's wrong with the input as a whole, which ended at size,
+ * and hand over the tree.
+ */
+Expression TreeBuilder::finish(uint32_t size) {
+  if (!stack.empty()) {
+    report(diagnostics, Diagnostic::UNCLOSED_LIST, size,
+	   "missing ')' for the list opened at byte " + std::to_string(offsets.front()));
+  } else if (!done) {
+    if ((diagnostics == nullptr) || (diagnostics->size() == reported)) {
+      report(diagnostics, Diagnostic::EMPTY_PROGRAM, size, "empty program");
+    }
+  } else if (bare_word && !extra_forms) {
+    report(diagnostics, Diagnostic::BARE_WORD, start_offset, "a program can't be a lone symbol");
+  }
+  return std::move(parse_tree);
+}
+
+/*
+ * The reader behind parse_text and parse_lazy. It reads [begin, size)
+ * of data, but offsets are from the start of data. Lists only become
+ * lazy if lazy is set, and then they keep source alive. When the range
+ * is itself a lazy list, brackets holds the lazy lists inside it, so
+ * they aren't skipped again. Errors are handled as TreeBuilder does.
+ */
+static Expression parse_buffer(const char * data, uint32_t begin, uint32_t size, size_t * depth,
+			       HashConser * conser, bool lazy,
+			       const std::shared_ptr<const std::string> & source,
+			       const std::shared_ptr<const Brackets> & brackets, size_t threshold,
+			       std::vector<Diagnostic> * diagnostics) {
+  TreeBuilder builder(depth, conser, diagnostics);
+  const char * cursor = data + begin;
+  const char * end = data + size;
+  // Lists that start before this are inside a branch too small to be
+  // lazy, so they are too.
+  uint32_t eager_until = 0;
+  std::vector<uint32_t> opens;
+  Brackets found;
+  // The cases have to follow the rules of token::Lexer::next.
+  while (cursor != end) {
+    uint32_t offset = cursor - data;
+    switch (*cursor) {
+    case '(':
+      if (lazy && (offset >= eager_until) && builder.in_branch()) {
+	uint32_t after = 0;
+	size_t nesting = 0;
+	if (brackets) {
+	  // Skipped already, along with the lazy list around it.
+	  Brackets::const_iterator known =
+	    std::lower_bound(brackets->begin(), brackets->end(), std::make_pair(offset, uint32_t(0)));
+	  if ((known != brackets->end()) && (known->first == offset)) {
+	    after = known->second;
+	  }
+	} else {
+	  eager_until = find_small_close(data, offset, size, threshold);
+	  if (eager_until == 0) {
+	    found.clear();
+	    after = skip_list(data, offset, size, threshold, opens, found, nesting);
+	    // With an error in it, the parse is going to fail anyway, so
+	    // there's no point looking for lazy lists any more.
+	    lazy = after != 0;
+	    eager_until = after;
+	  }
+	}
+	if ((after != 0) && (after - offset >= threshold)) {
+	  std::shared_ptr<LazySpan> span = std::make_shared<LazySpan>();
+	  span->data = data;
+	  span->source = source;
+	  if (brackets) {
+	    span->brackets = brackets;
+	  } else {
+	    std::sort(found.begin(), found.end());
+	    span->brackets = std::make_shared<const Brackets>(std::move(found));
+	  }
+	  span->begin = offset;
+	  span->end = after;
+	  span->threshold = threshold;
+	  builder.add_lazy(Expression(span, offset), nesting);
+	  cursor = data + after;
+	  break;
+	}
+      }
+      builder.open(offset);
+      cursor++;
+      break;
+    case ')':
+      builder.close(offset);
+      cursor++;
+      break;
+    case ';':
+      cursor = scan::find_newline(cursor, end);
+      if (cursor != end) {
+	cursor++;
+      }
+      break;
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+      {
+	size_t lines = 0;
+	cursor = scan::skip_space(cursor, end, lines);
+	break;
+      }
+    default:
+      {
+	const char * start = cursor;
+	cursor = scan::find_delimiter(cursor, end);
+	Expression atom;
+	if (read_atom(start, cursor - start, offset, atom)) {
+	  builder.atom(std::move(atom), offset);
+	} else {
+	  builder.bad_atom(start, cursor - start, offset);
+	}
+      }
+    }
+  }
+  return builder.finish(size);
+}
+
+Expression parse_tokens(token::Lexer & lexer, std::vector<Diagnostic> & diagnostics,
+			size_t * depth, HashConser * conser) {
+  TreeBuilder builder(depth, conser, &diagnostics);
+  const char * data = lexer.getData();
+  token::TokenView view;
+  while (lexer.next(view)) {
+    if (view.type == token::OPEN_PAREN) {
+      builder.open(view.offset);
+    } else if (view.type == token::CLOSE_PAREN) {
+      builder.close(view.offset);
+    } else if (is_atom_type(view.type)) {
+      builder.atom(parse_atom(view, data), view.offset);
+    } else {
+      builder.bad_atom(data + view.offset, view.length, view.offset);
+    }
+  }
+  return builder.finish(lexer.getOffset());
+}
+
+Expression parse_text(const char * data, size_t size, size_t * depth, HashConser * conser) {
+  return parse_buffer(data, 0, size, depth, conser, false, nullptr, nullptr, 0, nullptr);
+}
+
+Expression parse_text(const char * data, size_t size, std::vector<Diagnostic> & diagnostics,
+		      size_t * depth, HashConser * conser) {
+  return parse_buffer(data, 0, size, depth, conser, false, nullptr, nullptr, 0, &diagnostics);
+}
+
+Expression parse_lazy(std::shared_ptr<const std::string> source, size_t threshold,
+		      size_t * depth, HashConser * conser) {
+  return parse_buffer(source->data(), 0, source->size(), depth, conser, true, source, nullptr,
+		      threshold, nullptr);
+}
+
+Expression parse_lazy(std::shared_ptr<const std::string> source, size_t threshold,
+		      std::vector<Diagnostic> & diagnostics, size_t * depth, HashConser * conser) {
+  return parse_buffer(source->data(), 0, source->size(), depth, conser, true, source, nullptr,
+		      threshold, &diagnostics);
+}
+
+Expression parse_lazy(const char * data, size_t size, size_t threshold,
+		      std::vector<Diagnostic> & diagnostics, size_t * depth, HashConser * conser) {
+  return parse_buffer(data, 0, size, depth, conser, true, nullptr, nullptr, threshold,
+		      &diagnostics);
+}
+
+void force_lazy(const Expression & tree) {
+  std::vector<const Expression *> pending(1, &tree);
+  while (!pending.empty()) {
+    const Expression * expr = pending.back();
+    pending.pop_back();
+    if (expr->getType() == LIST) {
+      for (auto const & child : expr->getChildren()) {
+	pending.push_back(&child);
+      }
+    }
+  }
+}
+
+const std::vector<Expression> & Expression::list() const {
+  if (body->lazy) {
+    std::shared_ptr<LazySpan> span = body->lazy;
+    Expression parsed = parse_buffer(span->data, span->begin, span->end, nullptr, nullptr, true,
+				     span->source, span->brackets, span->threshold, nullptr);
+    if (parsed.body->references.load(std::memory_order_acquire) == 1) {
+      body->children = std::move(parsed.body->children);
+    } else {
+      body->children = parsed.body->children;
+    }
+    body->lazy.reset();
+  }
+  return body->children;
+}
+
 std::ostream & operator << (std::ostream & stream, const Expression & expr) {
   if (expr.type == NONE) {
     stream << "(None|None)";
@@ -253,12 +1009,12 @@ std::ostream & operator << (std::ostream & stream, const Expression & expr) {
     }
     stream << ")";
   } else if (expr.type == SYMBOL) {
-    stream << "(Symbol|" << expr.symbol_value << ")";
+    stream << "(Symbol|" << expr.symbol_value->name << ")";
   } else if (expr.type == NUMBER) {
     stream << "(Number|" << expr.number_value << ")";
   } else if (expr.type == LIST) {
     stream << "(Parent|{";
-    for (auto const & child : expr.children) {
+    for (auto const & child : expr.list()) {
       stream << child << "|";
     }
     stream << "}";
@@ -266,25 +1022,121 @@ std::ostream & operator << (std::ostream & stream, const Expression & expr) {
   return stream;
 }
 
-std::vector<Expression> Expression::getChildren() const {
-  return this->children;
+/*
+ * What the accessors hand out for the wrong type of expression.
+ */
+static const std::vector<Expression> no_children;
+static const std::string no_symbol;
+
+const std::vector<Expression> & Expression::getChildren() const {
+  if (type != LIST) {
+    return no_children;
+  }
+  return list();
+}
+
+const Expression & Expression::getChild(size_t index) const {
+  return getChildren().at(index);
+}
+
+size_t Expression::getChildCount() const {
+  return (type == LIST) ? list().size() : 0;
+}
+
+bool Expression::isLazy() const {
+  return (type == LIST) && body->lazy;
 }
 
 bool Expression::getBool() const {
-  return bool_value;
+  return (type == BOOL) && bool_value;
 }
+
 double Expression::getNumber() const {
-  return number_value;
+  return (type == NUMBER) ? number_value : 0;
+}
+
+const std::string & Expression::getSymbol() const {
+  return (type == SYMBOL) ? symbol_value->name : no_symbol;
 }
 
-std::string Expression::getSymbol() const {
-  return symbol_value;
+const symbol::Symbol * Expression::getInterned() const {
+  return (type == SYMBOL) ? symbol_value : nullptr;
+}
+
+symbol::SymbolId Expression::getSymbolId() const {
+  return (type == SYMBOL) ? symbol_value->id : symbol::NO_SYMBOL;
+}
+
+builtin::Opcode Expression::getOpcode() const {
+  return (type == SYMBOL) ? symbol_value->opcode : builtin::NO_OPCODE;
+}
+
+/*
+ * Copy the type, offset and whichever member of the union is in use.
+ * References aren't counted here.
+ */
+void Expression::copy_value(const Expression & other) noexcept {
+  this->type = other.type;
+  this->offset = other.offset;
+  switch (type) {
+  case BOOL:
+    this->bool_value = other.bool_value;
+    break;
+  case NUMBER:
+    this->number_value = other.number_value;
+    break;
+  case SYMBOL:
+    this->symbol_value = other.symbol_value;
+    break;
+  case LIST:
+    this->body = other.body;
+    break;
+  default:
+    this->number_value = 0;
+    break;
+  }
 }
 
 Expression::Expression(const Expression & other) {
-  this->type = other.getType();
-  this->bool_value = other.getBool();
-  this->number_value = other.getNumber();
-  this->symbol_value = other.getSymbol();
-  this->children = other.getChildren();
+  copy_value(other);
+  if (type == LIST) {
+    body->references.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+Expression::Expression(Expression && other) noexcept {
+  copy_value(other);
+  if (type == LIST) {
+    other.type = NONE;
+  }
+}
+
+Expression & Expression::operator=(const Expression & other) {
+  if (this != &other) {
+    if (other.type == LIST) {
+      other.body->references.fetch_add(1, std::memory_order_relaxed);
+    }
+    release();
+    copy_value(other);
+  }
+  return *this;
+}
+
+Expression & Expression::operator=(Expression && other) noexcept {
+  if (this != &other) {
+    release();
+    copy_value(other);
+    if (type == LIST) {
+      other.type = NONE;
+    }
+  }
+  return *this;
+}
+
+uint32_t Expression::getOffset() const {
+  return offset;
+}
+
+void Expression::setOffset(uint32_t offset) {
+  this->offset = offset;
 }
@@ -1,9 +1,13 @@
 #include <string>
 #include <vector>
+#include <memory>
+#include <cstdint>
+#include <unordered_map>
 #include <exception>
 #include <stdexcept>
 
 #include "tokenize.hpp"
+#include "symbol.hpp"
 
 #ifndef EXPRESSION_H
 #define EXPRESSION_H
@@ -21,31 +25,94 @@ enum AtomType {
   LIST
 };
 
+class Expression;
+
+/*
+ * The lists inside a lazy list that are big enough to be lazy
+ * themselves, as (open paren, just past close paren) offset pairs
+ * sorted by open paren. The pass that skips a lazy list finds them, so
+ * parsing it later can look them up instead of skipping them again.
+ */
+typedef std::vector<std::pair<uint32_t, uint32_t>> Brackets;
+
+/*
+ * A list the lazy parser only bracket-matched. It's the byte range
+ * [begin, end) of data, which is parsed when the list is first looked
+ * at. source keeps data alive if the parser was given a copy it owns,
+ * and is null if the text is only borrowed.
+ */
+struct LazySpan {
+  const char * data;
+  std::shared_ptr<const std::string> source;
+  std::shared_ptr<const Brackets> brackets;
+  uint32_t begin;
+  uint32_t end;
+  size_t threshold;
+};
+
 /*
  * An expression object. Expressions are a kind of tree represented by
- * vectors of vectors. They can be simplified by eval functions.
+ * vectors of vectors. They can be simplified by eval functions. Parsed
+ * expressions remember the byte offset they started at in the source,
+ * for error messages. The offset doesn't take part in comparisons.
+ * An expression is 16 bytes: its type, its offset and one word that
+ * holds a number, a bool, an interned symbol (see symbol.hpp) or a
+ * pointer to the body of a list. A list's children never change once
+ * it's built, so copies of a list share one reference counted body
+ * instead of copying the subtree. The accessors hand out references
+ * into the expression, so nothing is copied to look at a tree. They
+ * stay valid for as long as the expression they came from. A lazy
+ * list (see parse_lazy) is a LIST like any other, but it's only parsed
+ * the first time its children are needed. That fills in the body every
+ * copy shares, even through a const accessor, so a tree that still has
+ * lazy lists must only be read from one thread at a time. force_lazy
+ * parses them all up front, after which the tree never changes. Trees
+ * are torn down without recursion, so any nesting depth the parser
+ * accepts can also be freed.
  */
 class Expression {
 public:
   Expression();
   Expression(const Expression & other);
+  Expression(Expression && other) noexcept;
   Expression(bool value);
   Expression(double value);
-  Expression(const std::string value);
-  Expression(const std::vector<Expression>);
+  Expression(const std::string & value);
+  Expression(const symbol::Symbol * symbol);
+  Expression(std::vector<Expression> children);
+  Expression(std::shared_ptr<LazySpan> span, uint32_t offset);
+  ~Expression();
+  Expression & operator=(const Expression & other);
+  Expression & operator=(Expression && other) noexcept;
   AtomType getType() const;
-  std::vector<Expression> getChildren() const;
+  const std::vector<Expression> & getChildren() const;
+  const Expression & getChild(size_t index) const;
+  size_t getChildCount() const;
+  bool isLazy() const;
   bool getBool() const;
   double getNumber() const;
-  std::string getSymbol() const;
+  const std::string & getSymbol() const;
+  const symbol::Symbol * getInterned() const;
+  symbol::SymbolId getSymbolId() const;
+  builtin::Opcode getOpcode() const;
+  uint32_t getOffset() const;
+  void setOffset(uint32_t offset);
   bool operator==(const Expression & other) const noexcept;
   friend std::ostream & operator << (std::ostream & stream, const Expression & expr);
+  friend class HashConser;
 private:
+  struct ListBody;
+  const std::vector<Expression> & list() const;
+  void release() noexcept;
+  void copy_value(const Expression & other) noexcept;
+  union {
+    bool bool_value;
+    double number_value;
+    const symbol::Symbol * symbol_value;
+    ListBody * body;
+  };
+  uint32_t offset;
   AtomType type;
-  bool bool_value;
-  double number_value;
-  std::string symbol_value;
-  std::vector<Expression> children;
 };
 
 /*
@@ -54,38 +121,187 @@ private:
  */
 class InvalidTokenException : public std::exception {
 public:
-  InvalidTokenException(token::Token token) : token(token) {};
+  InvalidTokenException(token::Token token) : token(token), offset(0) {};
+  InvalidTokenException(token::Token token, uint32_t offset) : token(token), offset(offset) {};
   token::Token getToken();
+  uint32_t getOffset() const;
   const char * what() const noexcept;
 private:
   token::Token token;
+  uint32_t offset;
+};
+
+/*
+ * A syntax error found by a recovering parse. offset is where in the
+ * source it is and message says what's wrong.
+ */
+struct Diagnostic {
+  enum Kind {
+    EMPTY_PROGRAM,
+    BARE_WORD,
+    EXTRA_FORM,
+    STRAY_CLOSE,
+    EMPTY_LIST,
+    BAD_ATOM,
+    UNCLOSED_LIST,
+    NOT_A_LIST,
+    TOO_LARGE
+  };
+  Kind kind;
+  uint32_t offset;
+  std::string message;
+};
+
+/*
+ * How many lists a parse built, and how many of them were different.
+ * The rest shared the children of an identical list.
+ */
+struct ParseStats {
+  size_t lists;
+  size_t unique_lists;
+  double getDedupeRatio() const;
+};
+
+/*
+ * Builds lists so that structurally identical ones share a single set
+ * of children. Lists have to be built bottom up, as the parser does,
+ * so that identical child lists are already shared and can be told
+ * apart by address. Numbers are matched by their bits. Inside a shared
+ * subtree the offsets are the ones from where it first appeared.
+ */
+class HashConser {
+public:
+  HashConser();
+  Expression make_list(std::vector<Expression> children, uint32_t offset);
+  ParseStats getStats() const;
+private:
+  static uint64_t hash(const std::vector<Expression> & children);
+  static bool same(const std::vector<Expression> & left, const std::vector<Expression> & right);
+  // Each entry holds a reference to a body, so it stays around to be
+  // shared.
+  std::unordered_multimap<uint64_t, Expression> table;
+  size_t lists;
 };
 
 /*
  * Take an atom token and return an atom expression.
  */
-Expression parse_atom(token::Token token);
+Expression parse_atom(const token::Token & token);
+
+/*
+ * Take a view of an atom the lexer has already classified and return
+ * an atom expression. The text is never scanned again.
+ */
+Expression parse_atom(const token::TokenView & view, const char * data);
 
 /*
  * Utility functions. They return true if the given token matches a certain type.
  */
-bool match_open(token::Token token);
-bool match_close(token::Token token);
-bool match_bool(token::Token token);
-bool match_none(token::Token token);
-bool match_number(token::Token token);
-bool match_symbol(token::Token token);
+bool match_open(const token::Token & token);
+bool match_close(const token::Token & token);
+bool match_bool(const token::Token & token);
+bool match_none(const token::Token & token);
+bool match_number(const token::Token & token);
+bool match_symbol(const token::Token & token);
 
 /*
- * Take a list of tokens and return an expression tree.
+ * Take a list of tokens and return an expression tree. The list isn't
+ * changed.
  */
-Expression parse_tokens(std::list<token::Token> tokens);
+Expression parse_tokens(const std::list<token::Token> & tokens);
 
 /*
- * A recursive helper function for parse_tokens. The start of parse is
- * a special case, so parse_tokens_iter has to be wrapped by
- * parse_tokens.
+ * A helper function for parse_tokens. It's called just after an open
+ * paren, returns the list that paren starts and pops the tokens it
+ * used. The start of parse is a special case, so parse_tokens_iter has
+ * to be wrapped by parse_tokens. Unfinished lists are kept on a stack
+ * of its own rather than the call stack, so deep nesting only costs
+ * memory.
  */
 Expression parse_tokens_iter(std::list<token::Token> & tokens);
 
+/*
+ * The same as parse_tokens, but the tokens are pulled off a lexer as
+ * they're needed instead of coming from a list. No token container is
+ * ever built, so memory only grows with the nesting depth. If depth
+ * isn't null it's set to how deeply the lists were nested. If conser
+ * isn't null, it builds the lists.
+ */
+Expression parse_tokens(token::Lexer & lexer, size_t * depth = nullptr,
+			HashConser * conser = nullptr);
+
+/*
+ * The same as parse_tokens on a lexer, but errors are collected in
+ * diagnostics the way the parse_text overload that takes them does, so
+ * both report the same errors at the same offsets.
+ */
+Expression parse_tokens(token::Lexer & lexer, std::vector<Diagnostic> & diagnostics,
+			size_t * depth = nullptr, HashConser * conser = nullptr);
+
+/*
+ * The helper for the lexer version of parse_tokens. The offset is
+ * where the list's open paren was. Like the list version, it doesn't
+ * recurse.
+ */
+Expression parse_tokens_iter(token::Lexer & lexer, uint32_t offset, size_t * depth = nullptr,
+			     HashConser * conser = nullptr);
+
+/*
+ * Go straight from a buffer to an expression tree in one pass. It
+ * reads the same syntax and throws the same errors, at the same
+ * offsets, as parse_tokens on a token::Lexer, but it skips the tokens
+ * entirely and parses each number while checking it. If depth isn't
+ * null it's set to how deeply the lists were nested. If conser isn't
+ * null, it builds the lists.
+ */
+Expression parse_text(const char * data, size_t size, size_t * depth = nullptr,
+		      HashConser * conser = nullptr);
+
+/*
+ * The same as parse_text, but it never throws on a syntax error.
+ * Errors are added to diagnostics in the order they're found, and the
+ * parse picks up again at the next paren or atom: bad atoms and empty
+ * lists are left out, stray close parens are skipped and extra
+ * top-level forms are checked and then dropped. The first diagnostic is
+ * always the error parse_text would have thrown. The tree returned is
+ * only meant to be used if there were no errors.
+ */
+Expression parse_text(const char * data, size_t size, std::vector<Diagnostic> & diagnostics,
+		      size_t * depth = nullptr, HashConser * conser = nullptr);
+
+/*
+ * The same as parse_text, but branches of an if that take up at least
+ * threshold bytes are only checked and bracket-matched, and become
+ * lazy lists. Each is parsed, the same way, when it's first looked at,
+ * which eval only does for the branches it takes. Forms of a begin are
+ * all run, so they're parsed up front. The syntax is fully checked up
+ * front, so it accepts and rejects exactly what parse_text does. Each
+ * byte is skipped at most once: a branch too small to be lazy is
+ * parsed without looking for lazy lists inside it, and a lazy list
+ * remembers where the lazy lists inside it end.
+ */
+Expression parse_lazy(std::shared_ptr<const std::string> source, size_t threshold,
+		      size_t * depth = nullptr, HashConser * conser = nullptr);
+
+/*
+ * parse_lazy with the error recovery of parse_text.
+ */
+Expression parse_lazy(std::shared_ptr<const std::string> source, size_t threshold,
+		      std::vector<Diagnostic> & diagnostics, size_t * depth = nullptr,
+		      HashConser * conser = nullptr);
+
+/*
+ * parse_lazy over text it doesn't own. Nothing is copied, so the text
+ * has to outlive the tree and every copy of its lists.
+ */
+Expression parse_lazy(const char * data, size_t size, size_t threshold,
+		      std::vector<Diagnostic> & diagnostics, size_t * depth = nullptr,
+		      HashConser * conser = nullptr);
+
+/*
+ * Parse every lazy list in a tree, so it can be shared between threads.
+ * It doesn't recurse.
+ */
+void force_lazy(const Expression & tree);
+
 #endif
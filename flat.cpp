@@ -0,0 +1,357 @@
+#include "flat.hpp"
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+
+#include "expression.hpp"
+#include "environment.hpp"
+#include "interpreter.hpp"
+#include "symbol.hpp"
+#include "builtin.hpp"
+
+namespace flat {
+
+  size_t Tree::size() const {
+    return types.size();
+  }
+
+  bool Tree::empty() const {
+    return types.empty();
+  }
+
+  size_t Tree::getBytes() const {
+    size_t bytes = types.size() * (sizeof(uint8_t) + 3 * sizeof(uint32_t));
+    bytes += numbers.size() * sizeof(double);
+    bytes += forms.size() * sizeof(uint8_t);
+    bytes += ids.size() * sizeof(symbol::SymbolId);
+    for (auto & symbol : symbols) {
+      bytes += sizeof(std::string) + symbol.size();
+    }
+    return bytes;
+  }
+
+  Tree flatten(const Expression & program) {
+    Tree tree;
+    std::unordered_map<const symbol::Symbol *, uint32_t> pooled_symbols;
+    std::unordered_map<uint64_t, uint32_t> pooled_numbers;
+    // The expression each node came from, so its children can be laid
+    // out when its turn comes. Nodes are visited in the order they
+    // were added, which is what makes the layout breadth first.
+    std::vector<Expression> sources;
+    sources.push_back(program);
+    for (size_t i = 0; i < sources.size(); i++) {
+      // Adding children can move sources, so node isn't used after.
+      const Expression & node = sources[i];
+      AtomType type = node.getType();
+      uint32_t offset = node.getOffset();
+      uint32_t value = 0;
+      uint32_t count = 0;
+      switch (type) {
+      case BOOL:
+	value = node.getBool();
+	break;
+      case NUMBER:
+	{
+	  double number = node.getNumber();
+	  uint64_t bits;
+	  std::memcpy(&bits, &number, sizeof(bits));
+	  std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> entry =
+	    pooled_numbers.insert(std::make_pair(bits, static_cast<uint32_t>(tree.numbers.size())));
+	  if (entry.second) {
+	    tree.numbers.push_back(number);
+	  }
+	  value = entry.first->second;
+	  break;
+	}
+      case SYMBOL:
+	{
+	  const symbol::Symbol * symbol = node.getInterned();
+	  std::pair<std::unordered_map<const symbol::Symbol *, uint32_t>::iterator, bool> entry =
+	    pooled_symbols.insert(std::make_pair(symbol, static_cast<uint32_t>(tree.symbols.size())));
+	  if (entry.second) {
+	    tree.forms.push_back(symbol->opcode);
+	    tree.symbols.push_back(symbol->name);
+	    tree.ids.push_back(symbol->id);
+	  }
+	  value = entry.first->second;
+	  break;
+	}
+      case LIST:
+	{
+	  // The children live in the list's body, not in sources.
+	  const std::vector<Expression> & children = node.getChildren();
+	  value = sources.size();
+	  count = children.size();
+	  sources.insert(sources.end(), children.begin(), children.end());
+	  break;
+	}
+      default:
+	break;
+      }
+      tree.types.push_back(type);
+      tree.offsets.push_back(offset);
+      tree.values.push_back(value);
+      tree.counts.push_back(count);
+    }
+    return tree;
+  }
+
+  Expression expand(const Tree & tree, uint32_t index) {
+    Expression expr;
+    switch (tree.types[index]) {
+    case BOOL:
+      expr = Expression(tree.values[index] != 0);
+      break;
+    case NUMBER:
+      expr = Expression(tree.numbers[tree.values[index]]);
+      break;
+    case SYMBOL:
+      expr = Expression(tree.symbols[tree.values[index]]);
+      break;
+    case LIST:
+      {
+	std::vector<Expression> children;
+	children.reserve(tree.counts[index]);
+	for (uint32_t i = 0; i < tree.counts[index]; i++) {
+	  children.push_back(expand(tree, tree.values[index] + i));
+	}
+	expr = Expression(std::move(children));
+	break;
+      }
+    default:
+      break;
+    }
+    expr.setOffset(tree.offsets[index]);
+    return expr;
+  }
+
+  static Expression eval_node(const Tree & tree, uint32_t index, environment::Environment & env);
+
+  /*
+   * Evaluate node index if it has to be a number. Number atoms are read
+   * straight out of the pool rather than built into an Expression.
+   */
+  static inline bool eval_number(const Tree & tree, uint32_t index,
+				 environment::Environment & env, double & number) {
+    if (tree.types[index] == NUMBER) {
+      number = tree.numbers[tree.values[index]];
+      return true;
+    }
+    Expression value = eval_node(tree, index, env);
+    if (value.getType() != NUMBER) {
+      return false;
+    }
+    number = value.getNumber();
+    return true;
+  }
+
+  /*
+   * The same as eval_number, for a node that has to be a bool.
+   */
+  static inline bool eval_bool(const Tree & tree, uint32_t index,
+			       environment::Environment & env, bool & result) {
+    if (tree.types[index] == BOOL) {
+      result = tree.values[index] != 0;
+      return true;
+    }
+    Expression value = eval_node(tree, index, env);
+    if (value.getType() != BOOL) {
+      return false;
+    }
+    result = value.getBool();
+    return true;
+  }
+
+  /*
+   * What eval_numbers found in the arguments of a form.
+   */
+  struct Numbers {
+    double first;
+    double second;
+    double sum;
+    double product;
+  };
+
+  /*
+   * Evaluate the arguments of a form, after the symbol heading it, and
+   * fold the numbers among them. Like eval_iter, every argument is
+   * evaluated before any of their types are checked, so an unbound
+   * variable late in the list wins over a bad type early on.
+   */
+  static bool eval_numbers(const Tree & tree, uint32_t index, environment::Environment & env,
+			   Numbers & numbers) {
+    bool all = true;
+    numbers.first = 0;
+    numbers.second = 0;
+    numbers.sum = 0;
+    numbers.product = 1;
+    uint32_t first = tree.values[index];
+    for (uint32_t i = 1; i < tree.counts[index]; i++) {
+      double number;
+      if (!eval_number(tree, first + i, env, number)) {
+	all = false;
+	continue;
+      }
+      if (i == 1) {
+	numbers.first = number;
+      } else if (i == 2) {
+	numbers.second = number;
+      }
+      numbers.sum += number;
+      numbers.product *= number;
+    }
+    return all;
+  }
+
+  static bool eval_bools(const Tree & tree, uint32_t index, environment::Environment & env,
+			 bool all, bool & result) {
+    bool bools = true;
+    result = all;
+    uint32_t first = tree.values[index];
+    for (uint32_t i = 1; i < tree.counts[index]; i++) {
+      bool value;
+      if (!eval_bool(tree, first + i, env, value)) {
+	bools = false;
+      } else if (value != all) {
+	result = !all;
+      }
+    }
+    return bools;
+  }
+
+  /*
+   * Finish a builtin whose arguments are all numbers, given them
+   * folded.
+   */
+  static Expression apply_numbers(Form form, uint32_t argument_count, const Numbers & values) {
+    switch (form) {
+    case builtin::LESS:
+      return Expression(values.first < values.second);
+    case builtin::LESS_EQUAL:
+      return Expression(values.first <= values.second);
+    case builtin::GREATER:
+      return Expression(values.first > values.second);
+    case builtin::GREATER_EQUAL:
+      return Expression(values.first >= values.second);
+    case builtin::EQUAL:
+      return Expression(values.first == values.second);
+    case builtin::SUM:
+      return Expression(values.sum * 1.0);
+    case builtin::PRODUCT:
+      return Expression(values.product * 1.0);
+    case builtin::DIFFERENCE:
+      if (argument_count == 2) {
+	return Expression(values.first - values.second + 0.0);
+      }
+      return Expression(values.first * -1.0);
+    default:
+      return Expression(values.first / values.second);
+    }
+  }
+
+  static Expression eval_form(const Tree & tree, uint32_t index, Form form,
+			      environment::Environment & env) {
+    uint32_t count = tree.counts[index];
+    uint32_t first = tree.values[index];
+    if (form == builtin::NO_OPCODE) {
+      throw InvalidExpressionException(expand(tree, index));
+    }
+    if (!builtin::accepts(form, count - 1)) {
+      throw BadArgumentCountException(expand(tree, index));
+    }
+    if (builtin::builtins[form].arguments == builtin::NUMBERS) {
+      Numbers values;
+      if (!eval_numbers(tree, index, env, values)) {
+	throw BadArgumentTypeException(expand(tree, index));
+      }
+      return apply_numbers(form, count - 1, values);
+    }
+    switch (form) {
+    case builtin::NOT:
+      {
+	bool value;
+	if (!eval_bool(tree, first + 1, env, value)) {
+	  throw BadArgumentTypeException(expand(tree, index));
+	}
+	return Expression(!value);
+      }
+    case builtin::AND:
+    case builtin::OR:
+      {
+	bool result;
+	if (!eval_bools(tree, index, env, form == builtin::AND, result)) {
+	  throw BadArgumentTypeException(expand(tree, index));
+	}
+	return Expression(result);
+      }
+    case builtin::DEFINE:
+      {
+	uint32_t name = first + 1;
+	if ((tree.types[name] != SYMBOL) || (tree.forms[tree.values[name]] != builtin::NO_OPCODE)) {
+	  throw BadArgumentTypeException(expand(tree, index));
+	}
+	Expression value = eval_node(tree, first + 2, env);
+	env.set(tree.ids[tree.values[name]], value);
+	return value;
+      }
+    case builtin::BEGIN:
+      {
+	Expression value;
+	for (uint32_t i = 1; i < count; i++) {
+	  value = eval_node(tree, first + i, env);
+	}
+	return value;
+      }
+    case builtin::IF:
+      {
+	bool test;
+	if (!eval_bool(tree, first + 1, env, test)) {
+	  throw BadArgumentTypeException(expand(tree, index));
+	}
+	return eval_node(tree, first + (test ? 2 : 3), env);
+      }
+    default:
+      throw InvalidExpressionException(expand(tree, index));
+    }
+  }
+
+  static Expression eval_node(const Tree & tree, uint32_t index, environment::Environment & env) {
+    switch (tree.types[index]) {
+    case LIST:
+      {
+	uint32_t count = tree.counts[index];
+	uint32_t first = tree.values[index];
+	if (count == 0) {
+	  throw InvalidExpressionException(expand(tree, index));
+	}
+	if (count == 1) {
+	  return eval_node(tree, first, env);
+	}
+	if (tree.types[first] != SYMBOL) {
+	  throw InvalidExpressionException(expand(tree, index));
+	}
+	return eval_form(tree, index, static_cast<Form>(tree.forms[tree.values[first]]), env);
+      }
+    case SYMBOL:
+      if (tree.forms[tree.values[index]] == builtin::NO_OPCODE) {
+	return env.get(tree.ids[tree.values[index]]);
+      }
+      return expand(tree, index);
+    case NUMBER:
+      return Expression(tree.numbers[tree.values[index]]);
+    case BOOL:
+      return Expression(tree.values[index] != 0);
+    default:
+      return Expression();
+    }
+  }
+
+  Expression eval(const Tree & tree, environment::Environment & env) {
+    return eval_node(tree, 0, env);
+  }
+
+}
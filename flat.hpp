@@ -0,0 +1,68 @@
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "expression.hpp"
+#include "environment.hpp"
+#include "symbol.hpp"
+#include "builtin.hpp"
+
+#ifndef FLAT_H
+#define FLAT_H
+
+namespace flat {
+
+  /*
+   * What a symbol means to eval when it heads a list: the opcode of the
+   * builtin it names, or builtin::NO_OPCODE.
+   */
+  typedef builtin::Opcode Form;
+
+  /*
+   * A program laid out flat, as a struct of arrays. Node i is the i-th
+   * entry of types, offsets, values and counts, and node 0 is the
+   * root. Nodes are stored breadth first, so the children of a list
+   * are next to each other: they're the counts[i] nodes starting at
+   * values[i]. For an atom, values holds 0 or 1 for a bool, an index
+   * into numbers for a number, or an index into symbols for a symbol.
+   * Equal numbers and symbols share one pool entry, and forms says
+   * which form each pooled symbol names and ids its interned id, which
+   * is what the environment is looked up by. offsets are where the nodes
+   * were in the source, for error messages.
+   */
+  struct Tree {
+    std::vector<uint8_t> types;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> values;
+    std::vector<uint32_t> counts;
+    std::vector<double> numbers;
+    std::vector<std::string> symbols;
+    std::vector<symbol::SymbolId> ids;
+    std::vector<uint8_t> forms;
+    size_t size() const;
+    bool empty() const;
+    size_t getBytes() const;
+  };
+
+  /*
+   * Lay out a parsed program flat. Lazy lists are parsed on the way,
+   * taken or not, so a lazily parsed program gains nothing from it.
+   */
+  Tree flatten(const Expression & program);
+
+  /*
+   * Build the Expression for node index of a tree again.
+   */
+  Expression expand(const Tree & tree, uint32_t index);
+
+  /*
+   * Evaluate a flat program the same way eval_iter evaluates the tree
+   * it came from. It throws the same exceptions, carrying the
+   * expanded form that failed.
+   */
+  Expression eval(const Tree & tree, environment::Environment & env);
+
+}
+
+#endif
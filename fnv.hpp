@@ -0,0 +1,32 @@
+#include <cstddef>
+#include <cstdint>
+
+#ifndef FNV_H
+#define FNV_H
+
+namespace fnv {
+
+  /*
+   * The 64 bit FNV-1a parameters.
+   */
+  const uint64_t OFFSET_BASIS = 14695981039346656037ull;
+  const uint64_t PRIME = 1099511628211ull;
+
+  /*
+   * A 64 bit FNV-1a hash of a buffer. It goes a byte at a time, so it's
+   * meant for names and source text; the payload of a .vtc file is
+   * checked a word at a time (see compiled.cpp). The symbol table hashes
+   * every name it's given with it, so it's inline.
+   */
+  inline uint64_t hash(const char * data, size_t size) {
+    uint64_t value = OFFSET_BASIS;
+    for (size_t i = 0; i < size; i++) {
+      value ^= static_cast<unsigned char>(data[i]);
+      value *= PRIME;
+    }
+    return value;
+  }
+
+}
+
+#endif
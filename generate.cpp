@@ -0,0 +1,238 @@
+#include "generate.hpp"
+
+#include <string>
+#include <vector>
+
+namespace generate {
+
+  Options::Options() {
+    this->seed = 1;
+    this->forms = 1000;
+    this->bytes = 0;
+    this->depth = 4;
+    this->fanout = 4;
+    this->defines = 200;
+    this->reuse = 0.5;
+    this->if_density = 0.1;
+    this->comment_density = 0.05;
+  }
+
+  Random::Random(uint64_t seed) {
+    this->state = seed;
+  }
+
+  uint64_t Random::next() {
+    state += 0x9E3779B97F4A7C15ull;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+  uint64_t Random::below(uint64_t bound) {
+    return (bound == 0) ? 0 : next() % bound;
+  }
+
+  bool Random::chance(double probability) {
+    // 53 random bits, scaled into [0, 1).
+    return (next() >> 11) * (1.0 / 9007199254740992.0) < probability;
+  }
+
+  /*
+   * Builds one program. Expressions are generated by type, so every
+   * procedure gets arguments it accepts: numbers for arithmetic and
+   * comparisons, booleans for logic and for the test of an if.
+   */
+  class Generator {
+  public:
+    Generator(const Options & options) : options(options), random(options.seed) {}
+
+    std::string run() {
+      text = "(begin\n";
+      size_t defined = 0;
+      for (size_t form = 0; more(form); form++) {
+	comment();
+	text += "  ";
+	// Spread the defines out over the forms.
+	bool define = (defined < options.defines) &&
+	  ((options.forms == 0) || (defined * options.forms <= form * options.defines));
+	if (define) {
+	  define_symbol(defined);
+	  defined++;
+	} else if (random.chance(0.5)) {
+	  number(options.depth);
+	} else {
+	  boolean(options.depth);
+	}
+	text += "\n";
+      }
+      // End on a number so that vtscript has something to print.
+      text += "  ";
+      number(options.depth);
+      text += "\n)\n";
+      return text;
+    }
+
+  private:
+    bool more(size_t form) {
+      if (options.bytes != 0) {
+	return text.size() < options.bytes;
+      }
+      return form < options.forms;
+    }
+
+    void comment() {
+      if (random.chance(options.comment_density)) {
+	text += "  ; generated comment " + std::to_string(random.below(1000)) + "\n";
+      }
+    }
+
+    void define_symbol(size_t index) {
+      std::string name = "g" + std::to_string(index);
+      text += "(define " + name + " ";
+      if (random.chance(0.5)) {
+	number(options.depth);
+	numbers.push_back(name);
+      } else {
+	boolean(options.depth);
+	booleans.push_back(name);
+      }
+      text += ")";
+    }
+
+    // Either reuse a defined symbol or return false.
+    bool reuse(const std::vector<std::string> & symbols) {
+      if (symbols.empty() || !random.chance(options.reuse)) {
+	return false;
+      }
+      text += symbols[random.below(symbols.size())];
+      return true;
+    }
+
+    void number_literal() {
+      uint64_t value = random.below(100000);
+      if (random.chance(0.1)) {
+	text += "-";
+      }
+      switch (random.below(3)) {
+      case 0:
+	text += std::to_string(value % 100);
+	break;
+      case 1:
+	text += std::to_string(value / 100) + "." + std::to_string(value % 100);
+	break;
+      default:
+	text += std::to_string(value % 10) + "." + std::to_string(value % 1000) +
+	  "e" + std::to_string(random.below(5));
+      }
+    }
+
+    void arguments(int depth, int minimum, int maximum, bool numeric) {
+      int count = minimum + random.below(maximum - minimum + 1);
+      for (int i = 0; i < count; i++) {
+	text += " ";
+	if (numeric) {
+	  number(depth - 1);
+	} else {
+	  boolean(depth - 1);
+	}
+      }
+    }
+
+    int fanout() {
+      return (options.fanout < 2) ? 2 : options.fanout;
+    }
+
+    void number(int depth) {
+      if ((depth <= 0) || random.chance(0.3)) {
+	if (!reuse(numbers)) {
+	  number_literal();
+	}
+	return;
+      }
+      if (random.chance(options.if_density)) {
+	text += "(if ";
+	boolean(depth - 1);
+	text += " ";
+	number(depth - 1);
+	text += " ";
+	number(depth - 1);
+	text += ")";
+	return;
+      }
+      switch (random.below(5)) {
+      case 0:
+	text += "(+";
+	arguments(depth, 2, fanout(), true);
+	break;
+      case 1:
+	text += "(*";
+	arguments(depth, 2, fanout(), true);
+	break;
+      case 2:
+	text += "(-";
+	arguments(depth, 1, 2, true);
+	break;
+      case 3:
+	text += "(/";
+	arguments(depth, 2, 2, true);
+	break;
+      default:
+	text += "(";
+	number(depth - 1);
+      }
+      text += ")";
+    }
+
+    void boolean(int depth) {
+      if ((depth <= 0) || random.chance(0.3)) {
+	if (!reuse(booleans)) {
+	  text += random.chance(0.5) ? "True" : "False";
+	}
+	return;
+      }
+      if (random.chance(options.if_density)) {
+	text += "(if ";
+	boolean(depth - 1);
+	text += " ";
+	boolean(depth - 1);
+	text += " ";
+	boolean(depth - 1);
+	text += ")";
+	return;
+      }
+      static const char * comparisons[] = {"<", "<=", ">", ">=", "="};
+      switch (random.below(4)) {
+      case 0:
+	text += "(and";
+	arguments(depth, 2, fanout(), false);
+	break;
+      case 1:
+	text += "(or";
+	arguments(depth, 2, fanout(), false);
+	break;
+      case 2:
+	text += "(not";
+	arguments(depth, 1, 1, false);
+	break;
+      default:
+	text += "(";
+	text += comparisons[random.below(5)];
+	arguments(depth, 2, 2, true);
+      }
+      text += ")";
+    }
+
+    const Options & options;
+    Random random;
+    std::string text;
+    std::vector<std::string> numbers;
+    std::vector<std::string> booleans;
+  };
+
+  std::string program(const Options & options) {
+    Generator generator(options);
+    return generator.run();
+  }
+
+}
@@ -0,0 +1,59 @@
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef GENERATE_H
+#define GENERATE_H
+
+namespace generate {
+
+  /*
+   * The knobs for a generated program. A program is one top-level
+   * (begin ...) holding forms statements, or as many as it takes to
+   * reach bytes if that's set. Every program parses and evaluates
+   * without errors.
+   *
+   * depth is the deepest any expression nests. fanout is the most
+   * arguments a +, *, and or or gets. defines is how many of the forms
+   * are defines. reuse is the chance that a leaf refers to an already
+   * defined symbol instead of being a literal. if_density is the
+   * chance that an inner expression is an if. comment_density is the
+   * chance that a line gets a comment.
+   */
+  struct Options {
+    Options();
+    uint64_t seed;
+    size_t forms;
+    size_t bytes;
+    int depth;
+    int fanout;
+    size_t defines;
+    double reuse;
+    double if_density;
+    double comment_density;
+  };
+
+  /*
+   * A small random number generator (splitmix64). It's used instead of
+   * the standard engines and distributions so that the same seed gives
+   * the same program on every machine and standard library.
+   */
+  class Random {
+  public:
+    Random(uint64_t seed);
+    uint64_t next();
+    uint64_t below(uint64_t bound);
+    bool chance(double probability);
+  private:
+    uint64_t state;
+  };
+
+  /*
+   * Generate a program. The output depends only on the options.
+   */
+  std::string program(const Options & options);
+
+}
+
+#endif
@@ -2,37 +2,190 @@
 #include "interpreter_semantic_error.hpp"
 
 #include <istream>
+#include <iterator>
+#include <string>
 #include <vector>
 #include <list>
 #include <sstream>
 #include <math.h>
+#include <cstdint>
+#include <thread>
 
 #include "expression.hpp"
 #include "environment.hpp"
 #include "tokenize.hpp"
+#include "compiled.hpp"
+#include "flat.hpp"
+#include "symbol.hpp"
+#include "builtin.hpp"
 
 Interpreter::Interpreter() {
   environment.set("pi", atan2(0, -1));
+  error_located = false;
+  error_offset = 0;
+  depth = 0;
+  parse_cache = nullptr;
+  hash_consing = false;
+  lazy_threshold = 0;
+  flat_layout = false;
+  parse_stats.lists = 0;
+  parse_stats.unique_lists = 0;
+}
+
+bool Interpreter::hasErrorOffset() const {
+  return error_located;
+}
+
+uint32_t Interpreter::getErrorOffset() const {
+  return error_offset;
+}
+
+void Interpreter::setParallelOptions(const token::ParallelOptions & options) {
+  parallel = options;
+}
+
+void Interpreter::setParseCache(cache::ParseCache * cache) {
+  parse_cache = cache;
+}
+
+void Interpreter::setHashConsing(bool enabled) {
+  hash_consing = enabled;
+}
+
+void Interpreter::setLazyParsing(size_t threshold) {
+  lazy_threshold = threshold;
+}
+
+void Interpreter::setFlatLayout(bool enabled) {
+  flat_layout = enabled;
+}
+
+ParseStats Interpreter::getParseStats() const {
+  return parse_stats;
 }
 
 bool Interpreter::parse(std::istream & expr) noexcept {
   try {
-    std::list<token::Token> tokens = token::tokenize(expr);
-    expression = parse_tokens(tokens);
-    return expression.getChildren().size() != 0;
-  } catch (InvalidTokenException e) {
+    // Read the whole stream in one go so that the buffer lexer can
+    // work over it.
+    std::shared_ptr<const std::string> text =
+      std::make_shared<const std::string>((std::istreambuf_iterator<char>(expr)),
+					  std::istreambuf_iterator<char>());
+    return parse(text->data(), text->size(), text);
+  } catch (std::exception & e) {
+    return false;
+  }
+}
+
+bool Interpreter::parse(const char * data, size_t size) noexcept {
+  return parse(data, size, nullptr);
+}
+
+bool Interpreter::parse(const char * data, size_t size,
+			std::shared_ptr<const std::string> owner) noexcept {
+  error_located = false;
+  diagnostics.clear();
+  flat_program = flat::Tree();
+  if (size > UINT32_MAX) {
+    // Offsets are only 32 bits.
+    Diagnostic diagnostic;
+    diagnostic.kind = Diagnostic::TOO_LARGE;
+    diagnostic.offset = 0;
+    diagnostic.message = "input is bigger than 4 GB";
+    diagnostics.push_back(diagnostic);
+    return false;
+  }
+  try {
+    // A cache hit builds no lists, so it leaves the stats at 0.
+    parse_stats.lists = 0;
+    parse_stats.unique_lists = 0;
+    if ((parse_cache != nullptr) && parse_cache->lookup(data, size, expression, depth)) {
+      return true;
+    }
+    HashConser conser;
+    HashConser * builder = hash_consing ? &conser : nullptr;
+    unsigned threads = parallel.threads;
+    if (threads == 0) {
+      threads = std::thread::hardware_concurrency();
+    }
+    if (lazy_threshold > 0) {
+      // Lazy lists parse later, out of text that has to outlive them.
+      // The stream overload hands over the text it read; anything else
+      // belongs to the caller, who may free it before eval.
+      if (!owner) {
+	owner = std::make_shared<const std::string>(data, size);
+      }
+      expression = parse_lazy(owner, lazy_threshold, diagnostics, &depth, builder);
+    } else if ((size >= parallel.threshold) && (threads > 1)) {
+      std::vector<token::TokenView> tokens = token::tokenize_parallel(data, size, parallel);
+      token::Lexer lexer(data, size, tokens);
+      expression = parse_tokens(lexer, diagnostics, &depth, builder);
+    } else {
+      expression = parse_text(data, size, diagnostics, &depth, builder);
+    }
+    if (diagnostics.empty() && (expression.getChildCount() == 0)) {
+      Diagnostic diagnostic;
+      diagnostic.kind = Diagnostic::NOT_A_LIST;
+      diagnostic.offset = expression.getOffset();
+      diagnostic.message = "a program has to be a list with something in it";
+      diagnostics.push_back(diagnostic);
+    }
+    if (!diagnostics.empty()) {
+      error_located = true;
+      error_offset = diagnostics.front().offset;
+      return false;
+    }
+    parse_stats = conser.getStats();
+    // Trees too deep to evaluate aren't worth keeping.
+    if ((parse_cache != nullptr) && (depth <= MAX_EVAL_DEPTH)) {
+      parse_cache->insert(data, size, expression, depth);
+    }
+    return true;
+  } catch (std::exception & e) {
+    return false;
+  }
+}
+
+const std::vector<Diagnostic> & Interpreter::getDiagnostics() const {
+  return diagnostics;
+}
+
+bool Interpreter::load(const char * data, size_t size) noexcept {
+  error_located = false;
+  flat_program = flat::Tree();
+  try {
+    // A loaded program is only ever run flat, so there's no tree.
+    expression = Expression();
+    return compiled::load(data, size, flat_program, depth);
+  } catch (std::exception & e) {
     return false;
   }
 }
 
 Expression Interpreter::eval() {
+  error_located = false;
+  if (depth > MAX_EVAL_DEPTH) {
+    locate_error(expression);
+    throw InterpreterSemanticError("Expression nested too deeply.");
+  }
   try {
+    // Flattening would parse every lazy list, so a lazily parsed
+    // program is walked as a tree.
+    if (flat_layout && (lazy_threshold == 0) && flat_program.empty()) {
+      flat_program = flat::flatten(expression);
+    }
+    if (!flat_program.empty()) {
+      return flat::eval(flat_program, environment);
+    }
     return eval_iter(expression, environment);
   } catch (InvalidExpressionException e) {
+    locate_error(e.getExpression());
     throw InterpreterSemanticError("Expression could not be evaluated.");
   } catch (BadArgumentCountException e) {
+    locate_error(e.getExpression());
     throw InterpreterSemanticError("Bad argument count.");
   } catch (BadArgumentTypeException e) {
+    locate_error(e.getExpression());
     throw InterpreterSemanticError("Argumetn of wrong type.");
   } catch (environment::LookupException e) {
     throw InterpreterSemanticError("Unbound variable.");
@@ -41,302 +194,176 @@ Expression Interpreter::eval() {
   }
 }
 
-bool reserved_symbol(std::string symbol) {
-  std::vector<std::string> reserved = {
-    "not",
-    "and",
-    "or",
-    "<",
-    "<=",
-    ">",
-    ">=",
-    "=",
-    "+",
-    "-",
-    "*",
-    "/",
-    "define",
-    "begin",
-    "if"
-  };
-  for (auto reserved_symbol : reserved) {
-    if (symbol == reserved_symbol) {
-      return true;
-    }
-  }
-  return false;
+void Interpreter::locate_error(const Expression & expr) {
+  error_located = true;
+  error_offset = expr.getOffset();
 }
 
-Expression eval_iter(Expression expr, environment::Environment & env) {
+/*
+ * The handler for each builtin, indexed by opcode in the order of
+ * builtin::builtins.
+ */
+typedef Expression (*Handler)(const Expression & expr, environment::Environment & env);
+
+static const Handler handlers[builtin::OPCODE_COUNT] = {
+  nullptr, eval_not, eval_and, eval_or, eval_l_than, eval_le_than, eval_g_than,
+  eval_ge_than, eval_eq, eval_sum, eval_diff, eval_product, eval_ratio,
+  eval_define, eval_begin, eval_if
+};
+
+Expression eval_iter(const Expression & expr, environment::Environment & env) {
   if (expr.getType() != LIST) {
-    if ((expr.getType() == SYMBOL) && (!reserved_symbol(expr.getSymbol()))) {
-      return env.get(expr.getSymbol());
+    if ((expr.getType() == SYMBOL) && (expr.getOpcode() == builtin::NO_OPCODE)) {
+      return env.get(expr.getSymbolId());
     } else {
       return expr;
     }
   } else {
-    std::vector<Expression> children = expr.getChildren();
+    const std::vector<Expression> & children = expr.getChildren();
     if (children.size() == 0) {
       throw InvalidExpressionException(expr);
     } else if (children.size() == 1) {
       return eval_iter(children.front(), env);
-    } else if (children.front().getType() != SYMBOL) {
-      throw InvalidExpressionException(expr);
-    } else if (children.front().getSymbol() == "not") {
-      return eval_not(expr, env);
-    } else if (children.front().getSymbol() == "and") {
-      return eval_and(expr, env);
-    } else if (children.front().getSymbol() == "or") {
-      return eval_or(expr, env);
-    } else if (children.front().getSymbol() == "<") {
-      return eval_l_than(expr, env);
-    } else if (children.front().getSymbol() == "<=") {
-      return eval_le_than(expr, env);
-    } else if (children.front().getSymbol() == ">") {
-      return eval_g_than(expr, env);
-    } else if (children.front().getSymbol() == ">=") {
-      return eval_ge_than(expr, env);
-    } else if (children.front().getSymbol() == "=") {
-      return eval_eq(expr, env);
-    } else if (children.front().getSymbol() == "+") {
-      return eval_sum(expr, env);
-    } else if (children.front().getSymbol() == "-") {
-      return eval_diff(expr, env);
-    } else if (children.front().getSymbol() == "*") {
-      return eval_product(expr, env);
-    } else if (children.front().getSymbol() == "/") {
-      return eval_ratio(expr, env);
-    } else if (children.front().getSymbol() == "define") {
-      return eval_define(expr, env);
-    } else if (children.front().getSymbol() == "begin") {
-      return eval_begin(expr, env);
-    } else if (children.front().getSymbol() == "if") {
-      return eval_if(expr, env);
-    } else {
+    }
+    // The head was resolved to an opcode when it was parsed.
+    builtin::Opcode opcode = children.front().getOpcode();
+    if (opcode == builtin::NO_OPCODE) {
       throw InvalidExpressionException(expr);
     }
+    if (!builtin::accepts(opcode, children.size() - 1)) {
+      throw BadArgumentCountException(expr);
+    }
+    return handlers[opcode](expr, env);
   }
-  throw InvalidExpressionException(expr);
 }
 
-Expression eval_not(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() != 2) {
-    throw BadArgumentCountException(expr);
-  }
-  Expression evaluated_child = eval_iter(expr.getChildren().at(1), env);
+Expression eval_not(const Expression & expr, environment::Environment & env) {
+  Expression evaluated_child = eval_iter(expr.getChild(1), env);
   if (evaluated_child.getType() != BOOL) {
     throw BadArgumentTypeException(expr);
   }
   return Expression(!evaluated_child.getBool());
 }
 
-Expression eval_and(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() < 3) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
-  }
-  if (!is_all_type(BOOL, simplified_expr)) {
-    throw BadArgumentTypeException(expr);
-  }
-  simplified_expr.erase(simplified_expr.begin());
-  bool accum = true;
-  for (auto & child : simplified_expr) {
-    accum = accum && child.getBool();
-  }
-  return Expression(accum);
-}
-
-bool is_all_type(AtomType type, std::vector<Expression> expressions) {
-  bool skip_first = true;
-  for (auto & expr : expressions) {
-    if (skip_first) {
-      skip_first = false;
+/*
+ * Evaluate the arguments of a form, everything after the symbol that
+ * heads it. Every argument is evaluated before any of their types are
+ * checked, so an unbound variable late in the list wins over a bad type
+ * early on. The values are folded as they come instead of being kept.
+ */
+struct NumberArguments {
+  double first;
+  double second;
+  double sum;
+  double product;
+};
+
+static NumberArguments eval_numbers(const Expression & expr, environment::Environment & env) {
+  NumberArguments arguments = {0, 0, 0, 1};
+  bool all_numbers = true;
+  const std::vector<Expression> & children = expr.getChildren();
+  for (size_t i = 1; i < children.size(); i++) {
+    Expression value = eval_iter(children[i], env);
+    if (value.getType() != NUMBER) {
+      all_numbers = false;
       continue;
     }
-    if (expr.getType() != type) {
-      return false;
+    if (i == 1) {
+      arguments.first = value.getNumber();
+    } else if (i == 2) {
+      arguments.second = value.getNumber();
     }
+    arguments.sum += value.getNumber();
+    arguments.product *= value.getNumber();
   }
-  return true;
-}
-
-Expression eval_or(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() < 3) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
-  }
-  if (!is_all_type(BOOL, simplified_expr)) {
+  if (!all_numbers) {
     throw BadArgumentTypeException(expr);
   }
-  simplified_expr.erase(simplified_expr.begin());
-  bool accum = false;
-  for (auto & child : simplified_expr) {
-    accum = accum || child.getBool();
-  }
-  return Expression(accum);
+  return arguments;
 }
 
-Expression eval_l_than(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() != 3) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
+static bool eval_bools(const Expression & expr, environment::Environment & env, bool all) {
+  bool result = all;
+  bool all_bools = true;
+  const std::vector<Expression> & children = expr.getChildren();
+  for (size_t i = 1; i < children.size(); i++) {
+    Expression value = eval_iter(children[i], env);
+    if (value.getType() != BOOL) {
+      all_bools = false;
+    } else if (value.getBool() != all) {
+      result = !all;
+    }
   }
-  if(!is_all_type(NUMBER, simplified_expr)) {
+  if (!all_bools) {
     throw BadArgumentTypeException(expr);
   }
-  Expression expr1 = simplified_expr.at(1);
-  Expression expr2 = simplified_expr.at(2);
-  return Expression(expr1.getNumber() < expr2.getNumber());  
+  return result;
 }
 
-Expression eval_le_than(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() != 3) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
-  }
-  if(!is_all_type(NUMBER, simplified_expr)) {
-    throw BadArgumentTypeException(expr);
-  }
-  Expression expr1 = simplified_expr.at(1);
-  Expression expr2 = simplified_expr.at(2);
-  return Expression(expr1.getNumber() <= expr2.getNumber());
+Expression eval_and(const Expression & expr, environment::Environment & env) {
+  return Expression(eval_bools(expr, env, true));
 }
 
-Expression eval_g_than(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() != 3) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
-  }
-  if(!is_all_type(NUMBER, simplified_expr)) {
-    throw BadArgumentTypeException(expr);
-  }
-  Expression expr1 = simplified_expr.at(1);
-  Expression expr2 = simplified_expr.at(2);
-  return Expression(expr1.getNumber() > expr2.getNumber());
+Expression eval_or(const Expression & expr, environment::Environment & env) {
+  return Expression(eval_bools(expr, env, false));
 }
 
-Expression eval_ge_than(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() != 3) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
-  }
-  if(!is_all_type(NUMBER, simplified_expr)) {
-    throw BadArgumentTypeException(expr);
-  }
-  Expression expr1 = simplified_expr.at(1);
-  Expression expr2 = simplified_expr.at(2);
-  return Expression(expr1.getNumber() >= expr2.getNumber());
+Expression eval_l_than(const Expression & expr, environment::Environment & env) {
+  NumberArguments arguments = eval_numbers(expr, env);
+  return Expression(arguments.first < arguments.second);
 }
 
-Expression eval_eq(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() != 3) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
-  }
-  if(!is_all_type(NUMBER, simplified_expr)) {
-    throw BadArgumentTypeException(expr);
-  }
-  Expression expr1 = simplified_expr.at(1);
-  Expression expr2 = simplified_expr.at(2);
-  return Expression(expr1.getNumber() == expr2.getNumber());
+Expression eval_le_than(const Expression & expr, environment::Environment & env) {
+  NumberArguments arguments = eval_numbers(expr, env);
+  return Expression(arguments.first <= arguments.second);
 }
 
-Expression eval_sum(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() < 3) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
-  }
-  if(!is_all_type(NUMBER, simplified_expr)) {
-    throw BadArgumentTypeException(expr);
-  }
-  simplified_expr.erase(simplified_expr.begin());
-  double accum = 0;
-  for (auto & child : simplified_expr) {
-    accum += child.getNumber();
-  }
-  return Expression(accum * 1.0);
+Expression eval_g_than(const Expression & expr, environment::Environment & env) {
+  NumberArguments arguments = eval_numbers(expr, env);
+  return Expression(arguments.first > arguments.second);
 }
 
-Expression eval_diff(Expression expr, environment::Environment & env) {
-  if ((expr.getChildren().size() == 3) || (expr.getChildren().size() == 2)) {
+Expression eval_ge_than(const Expression & expr, environment::Environment & env) {
+  NumberArguments arguments = eval_numbers(expr, env);
+  return Expression(arguments.first >= arguments.second);
+}
 
-    std::vector<Expression> simplified_expr;
-    for (auto & child : expr.getChildren()) {
-      simplified_expr.push_back(eval_iter(child, env));
-    }
-    if(!is_all_type(NUMBER, simplified_expr)) {
-      throw BadArgumentTypeException(expr);
-    }
-    if (expr.getChildren().size() == 3) {
-      Expression expr1 = simplified_expr.at(1);
-      Expression expr2 = simplified_expr.at(2);
-      return Expression(expr1.getNumber() - expr2.getNumber() + 0.0);
-    } else {
-      Expression expr1 = simplified_expr.at(1);
-      return Expression(expr1.getNumber() * -1.0);
-    }
-  } else {
-      throw BadArgumentCountException(expr);
-  }
+Expression eval_eq(const Expression & expr, environment::Environment & env) {
+  NumberArguments arguments = eval_numbers(expr, env);
+  return Expression(arguments.first == arguments.second);
 }
 
-Expression eval_product(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() < 3) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
-  }
-  if(!is_all_type(NUMBER, simplified_expr)) {
-    throw BadArgumentTypeException(expr);
-  }
-  simplified_expr.erase(simplified_expr.begin());
-  double accum = 1;
-  for (auto & child : simplified_expr) {
-    accum *= child.getNumber();
-  }
-  return Expression(accum * 1.0);
+Expression eval_sum(const Expression & expr, environment::Environment & env) {
+  return Expression(eval_numbers(expr, env).sum * 1.0);
 }
 
-Expression eval_ratio(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() != 3) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
-  }
-  if(!is_all_type(NUMBER, simplified_expr)) {
-    throw BadArgumentTypeException(expr);
+Expression eval_diff(const Expression & expr, environment::Environment & env) {
+  NumberArguments arguments = eval_numbers(expr, env);
+  if (expr.getChildCount() == 3) {
+    return Expression(arguments.first - arguments.second + 0.0);
   }
-  Expression expr1 = simplified_expr.at(1);
-  Expression expr2 = simplified_expr.at(2);
-  return Expression(expr1.getNumber() / expr2.getNumber());  
+  return Expression(arguments.first * -1.0);
+}
+
+Expression eval_product(const Expression & expr, environment::Environment & env) {
+  return Expression(eval_numbers(expr, env).product * 1.0);
+}
+
+Expression eval_ratio(const Expression & expr, environment::Environment & env) {
+  NumberArguments arguments = eval_numbers(expr, env);
+  return Expression(arguments.first / arguments.second);
+}
+
+Expression BadArgumentTypeException::getExpression() {
+  return expression;
+}
+
+Expression BadArgumentCountException::getExpression() {
+  return expression;
+}
+
+Expression InvalidExpressionException::getExpression() {
+  return expression;
 }
 
 const char * BadArgumentTypeException::what () const noexcept {
@@ -361,49 +388,34 @@ std::stringstream stream;
   return output.c_str();
 }
 
-Expression eval_define(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() != 3) {
-    throw BadArgumentCountException(expr);
-  }
-
-  if (expr.getChildren().at(1).getType() != SYMBOL) {
+Expression eval_define(const Expression & expr, environment::Environment & env) {
+  if ((expr.getChild(1).getType() != SYMBOL) ||
+      (expr.getChild(1).getOpcode() != builtin::NO_OPCODE)) {
     throw BadArgumentTypeException(expr);
   }
 
-  if (reserved_symbol(expr.getChildren().at(1).getSymbol())) {
-    throw BadArgumentTypeException(expr);
-  }
-
-  std::string symbol = expr.getChildren().at(1).getSymbol();
-  Expression value = eval_iter(expr.getChildren().at(2), env);
-  env.set(symbol, value);
+  Expression value = eval_iter(expr.getChild(2), env);
+  env.set(expr.getChild(1).getSymbolId(), value);
   return value;
 }
 
-Expression eval_begin(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() < 2) {
-    throw BadArgumentCountException(expr);
-  }
-  std::vector<Expression> simplified_expr;
-  for (auto & child : expr.getChildren()) {
-    simplified_expr.push_back(eval_iter(child, env));
+Expression eval_begin(const Expression & expr, environment::Environment & env) {
+  const std::vector<Expression> & children = expr.getChildren();
+  Expression value;
+  for (size_t i = 1; i < children.size(); i++) {
+    value = eval_iter(children[i], env);
   }
-  return simplified_expr.back();
+  return value;
 }
 
-Expression eval_if(Expression expr, environment::Environment & env) {
-  if (expr.getChildren().size() != 4) {
-    throw BadArgumentCountException(expr);
-  }
-
-  std::vector<Expression> children = expr.getChildren();
-  Expression test_expr = eval_iter(children.at(1), env);
+Expression eval_if(const Expression & expr, environment::Environment & env) {
+  Expression test_expr = eval_iter(expr.getChild(1), env);
   if (test_expr.getType() != BOOL) {
     throw BadArgumentTypeException(expr);    
   }
   if (test_expr.getBool()) {
-    return eval_iter(children.at(2), env);
+    return eval_iter(expr.getChild(2), env);
   } else {
-    return eval_iter(children.at(3), env);
+    return eval_iter(expr.getChild(3), env);
   }
 }
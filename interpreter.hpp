@@ -1,5 +1,8 @@
 #include "expression.hpp"
 #include "environment.hpp"
+#include "tokenize.hpp"
+#include "cache.hpp"
+#include "flat.hpp"
 
 #ifndef INTERPRETER_H
 #define INTERPRETER_H
@@ -8,45 +11,90 @@
  * A class for interpreting code. To use it, create one, call parse on
  * a text stream, check the result of parse to see if the text was
  * valid, and if it is, call eval. Curious about why eval doesn't call
- * parse internally and automatically? Me too.
+ * parse internally and automatically? Me too. If either one fails,
+ * the byte offset of the problem is kept when it's known. A failed
+ * parse also keeps every syntax error it found, see getDiagnostics. Big inputs
+ * are lexed on several threads, see token::ParallelOptions. A
+ * program compiled ahead of time (see compiled.hpp) can be loaded in
+ * place of parse, and is then run flat. Given a cache::ParseCache, parse reuses the programs
+ * of texts it has seen before. The cache isn't owned and has to outlive
+ * the interpreter. With hash consing on, identical subtrees of a
+ * program share their storage and getParseStats tells how many did.
+ * With lazy parsing on, if branches of at least the given size are
+ * only parsed once eval reaches them (see parse_lazy). They're parsed
+ * out of a copy of the text the interpreter keeps, so the caller's
+ * buffer can go as soon as parse returns. Lazy parsing takes
+ * precedence over lexing on several threads, so big inputs are lazy
+ * too. With the flat layout on, eval lays the program out flat
+ * (see flat.hpp) the first time it runs it and walks that instead,
+ * unless lazy parsing is on too: laying a program out parses all of
+ * it, so lazy parsing wins. Any nesting depth parses, but eval still
+ * recurses, so it refuses programs nested deeper than MAX_EVAL_DEPTH.
  */
 class Interpreter {
 public:
   Interpreter();
   bool parse(std::istream & expression) noexcept;
+  bool parse(const char * data, size_t size) noexcept;
+  bool load(const char * data, size_t size) noexcept;
   Expression eval();
+  bool hasErrorOffset() const;
+  uint32_t getErrorOffset() const;
+  const std::vector<Diagnostic> & getDiagnostics() const;
+  void setParallelOptions(const token::ParallelOptions & options);
+  void setParseCache(cache::ParseCache * cache);
+  void setHashConsing(bool enabled);
+  void setLazyParsing(size_t threshold);
+  void setFlatLayout(bool enabled);
+  ParseStats getParseStats() const;
 private:
+  bool parse(const char * data, size_t size, std::shared_ptr<const std::string> owner) noexcept;
+  void locate_error(const Expression & expr);
   Expression expression;
+  size_t depth;
   environment::Environment environment;
+  bool error_located;
+  uint32_t error_offset;
+  std::vector<Diagnostic> diagnostics;
+  token::ParallelOptions parallel;
+  cache::ParseCache * parse_cache;
+  bool hash_consing;
+  size_t lazy_threshold;
+  ParseStats parse_stats;
+  bool flat_layout;
+  flat::Tree flat_program;
 };
 
 /*
- * A helper function that checks if every element in a vector has a
- * certain type. It's used for type checking in eval.
+ * The deepest nesting eval will try. Past this it would run out of
+ * stack.
  */
-bool is_all_type(AtomType type, std::vector<Expression> expressions);
+const size_t MAX_EVAL_DEPTH = 2000;
 
 /*
- * These functions all evaluate small forms. The main eval functions
- * dispatches them.
+ * These functions all evaluate small forms. The main eval function
+ * dispatches them through a table indexed by opcode, after checking
+ * the argument count against builtin::builtins, so they don't check
+ * it again. They walk the tree by reference and allocate nothing but
+ * the values they return, so eval is linear in the size of the tree.
  */
-Expression eval_iter(Expression expr, environment::Environment & env);
-Expression eval_not(Expression expr, environment::Environment & env);
-Expression eval_and(Expression expr, environment::Environment & env);
-Expression eval_or(Expression expr, environment::Environment & env);
-Expression eval_l_than(Expression expr, environment::Environment & env);
-Expression eval_le_than(Expression expr, environment::Environment & env);
-Expression eval_g_than(Expression expr, environment::Environment & env);
-Expression eval_ge_than(Expression expr, environment::Environment & env);
-Expression eval_eq(Expression expr, environment::Environment & env);
-Expression eval_sum(Expression expr, environment::Environment & env);
-Expression eval_diff(Expression expr, environment::Environment & env);
-Expression eval_product(Expression expr, environment::Environment & env);
-Expression eval_ratio(Expression expr, environment::Environment & env);
+Expression eval_iter(const Expression & expr, environment::Environment & env);
+Expression eval_not(const Expression & expr, environment::Environment & env);
+Expression eval_and(const Expression & expr, environment::Environment & env);
+Expression eval_or(const Expression & expr, environment::Environment & env);
+Expression eval_l_than(const Expression & expr, environment::Environment & env);
+Expression eval_le_than(const Expression & expr, environment::Environment & env);
+Expression eval_g_than(const Expression & expr, environment::Environment & env);
+Expression eval_ge_than(const Expression & expr, environment::Environment & env);
+Expression eval_eq(const Expression & expr, environment::Environment & env);
+Expression eval_sum(const Expression & expr, environment::Environment & env);
+Expression eval_diff(const Expression & expr, environment::Environment & env);
+Expression eval_product(const Expression & expr, environment::Environment & env);
+Expression eval_ratio(const Expression & expr, environment::Environment & env);
 
-Expression eval_define(Expression expr, environment::Environment & env);
-Expression eval_begin(Expression expr, environment::Environment & env);
-Expression eval_if(Expression expr, environment::Environment & env);
+Expression eval_define(const Expression & expr, environment::Environment & env);
+Expression eval_begin(const Expression & expr, environment::Environment & env);
+Expression eval_if(const Expression & expr, environment::Environment & env);
 
 
 /*
@@ -0,0 +1,409 @@
+#include "number.hpp"
+
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace number {
+
+  static inline bool is_digit(char c) {
+    return (c >= '0') && (c <= '9');
+  }
+
+  /*
+   * Powers of ten that a double holds exactly.
+   */
+  static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+
+  /*
+   * Past this many significant digits the rest of a literal can't
+   * change how it rounds, other than through whether any of them are
+   * nonzero.
+   */
+  static const int MAX_DIGITS = 780;
+
+  /*
+   * Exponents are clamped here while they're read in. Anything this
+   * big is already zero or infinity.
+   */
+  static const long MAX_EXPONENT = 100000;
+
+  /*
+   * A fixed size unsigned big integer for the slow path. The limit is
+   * big enough for the largest product compare_scaled can build.
+   */
+  class BigInt {
+  public:
+    BigInt() : size(0) {}
+
+    void multiply(uint32_t factor) {
+      uint64_t carry = 0;
+      for (int i = 0; i < size; i++) {
+	uint64_t product = (uint64_t) limbs[i] * factor + carry;
+	limbs[i] = (uint32_t) product;
+	carry = product >> 32;
+      }
+      push(carry);
+    }
+
+    void add(uint32_t value) {
+      uint64_t carry = value;
+      for (int i = 0; (i < size) && (carry != 0); i++) {
+	uint64_t sum = (uint64_t) limbs[i] + carry;
+	limbs[i] = (uint32_t) sum;
+	carry = sum >> 32;
+      }
+      push(carry);
+    }
+
+    void multiply_pow10(long exponent) {
+      while (exponent >= 9) {
+	multiply(1000000000u);
+	exponent -= 9;
+      }
+      static const uint32_t small[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+      };
+      if (exponent > 0) {
+	multiply(small[exponent]);
+      }
+    }
+
+    void shift_left(long bits) {
+      if (size == 0) {
+	return;
+      }
+      int words = bits / 32;
+      int rest = bits % 32;
+      if (rest != 0) {
+	uint32_t carry = 0;
+	for (int i = 0; i < size; i++) {
+	  uint32_t limb = limbs[i];
+	  limbs[i] = (limb << rest) | carry;
+	  carry = limb >> (32 - rest);
+	}
+	push(carry);
+      }
+      if (words != 0) {
+	if (size + words > LIMBS) {
+	  words = LIMBS - size;
+	}
+	std::memmove(limbs + words, limbs, size * sizeof(uint32_t));
+	std::memset(limbs, 0, words * sizeof(uint32_t));
+	size += words;
+      }
+    }
+
+    int compare(const BigInt & other) const {
+      if (size != other.size) {
+	return (size < other.size) ? -1 : 1;
+      }
+      for (int i = size - 1; i >= 0; i--) {
+	if (limbs[i] != other.limbs[i]) {
+	  return (limbs[i] < other.limbs[i]) ? -1 : 1;
+	}
+      }
+      return 0;
+    }
+
+    static BigInt from(uint64_t value) {
+      BigInt result;
+      result.push(value & 0xFFFFFFFFu);
+      result.push(value >> 32);
+      return result;
+    }
+
+  private:
+    void push(uint64_t carry) {
+      if ((carry != 0) && (size < LIMBS)) {
+	limbs[size++] = (uint32_t) carry;
+      }
+    }
+
+    static const int LIMBS = 128;
+    uint32_t limbs[LIMBS];
+    int size;
+  };
+
+  /*
+   * Return the sign of digits * 10^e10 - mantissa * 2^e2.
+   */
+  static int compare_scaled(const BigInt & digits, long e10, uint64_t mantissa, long e2) {
+    BigInt left = digits;
+    BigInt right = BigInt::from(mantissa);
+    if (e10 >= 0) {
+      left.multiply_pow10(e10);
+    } else {
+      right.multiply_pow10(-e10);
+    }
+    if (e2 >= 0) {
+      right.shift_left(e2);
+    } else {
+      left.shift_left(-e2);
+    }
+    return left.compare(right);
+  }
+
+  /*
+   * Split a positive finite double into an integer mantissa and a
+   * binary exponent, so that value = mantissa * 2^exponent.
+   */
+  static void decompose(double value, uint64_t & mantissa, long & exponent) {
+    int binary;
+    double fraction = std::frexp(value, &binary);
+    mantissa = (uint64_t) std::ldexp(fraction, 53);
+    exponent = binary - 53;
+    if (exponent < -1074) {
+      mantissa >>= (-1074 - exponent);
+      exponent = -1074;
+    }
+  }
+
+  /*
+   * The slow path. Start from a guess that's within an ulp or two,
+   * then compare the exact decimal value against the halfway points
+   * on either side of the guess and step until it's the nearest
+   * double. This is Clinger's AlgorithmR with big integer compares.
+   */
+  static double refine(const BigInt & digits, long e10, double guess) {
+    double candidate = guess;
+    if (candidate == 0) {
+      candidate = std::numeric_limits<double>::denorm_min();
+    } else if (std::isinf(candidate)) {
+      candidate = DBL_MAX;
+    }
+    while (true) {
+      uint64_t mantissa;
+      long exponent;
+      decompose(candidate, mantissa, exponent);
+      int upper = compare_scaled(digits, e10, 2 * mantissa + 1, exponent - 1);
+      if ((upper > 0) || ((upper == 0) && (mantissa & 1))) {
+	candidate = std::nextafter(candidate, HUGE_VAL);
+	if (std::isinf(candidate)) {
+	  return candidate;
+	}
+	continue;
+      }
+      // Below a power of two the gap to the next double down is half
+      // as wide.
+      int lower;
+      if ((mantissa == ((uint64_t) 1 << 52)) && (exponent > -1074)) {
+	lower = compare_scaled(digits, e10, 4 * mantissa - 1, exponent - 2);
+      } else {
+	lower = compare_scaled(digits, e10, 2 * mantissa - 1, exponent - 1);
+      }
+      if ((lower < 0) || ((lower == 0) && (mantissa & 1))) {
+	candidate = std::nextafter(candidate, 0.0);
+	if (candidate == 0) {
+	  return candidate;
+	}
+	continue;
+      }
+      return candidate;
+    }
+  }
+
+  /*
+   * Check the grammar and find where the mantissa ends. The exponent
+   * is read along the way.
+   */
+  static bool scan(const char * text, size_t length, const char * & mantissa_end, long & exponent) {
+    const char * cursor = text;
+    const char * end = text + length;
+    if ((cursor != end) && ((*cursor == '+') || (*cursor == '-'))) {
+      cursor++;
+    }
+    bool hit_dot = false;
+    bool hit_digit = false;
+    while (cursor != end) {
+      if (is_digit(*cursor)) {
+	hit_digit = true;
+      } else if ((*cursor == '.') && !hit_dot && (cursor != text)) {
+	hit_dot = true;
+      } else {
+	break;
+      }
+      cursor++;
+    }
+    if (!hit_digit) {
+      return false;
+    }
+    mantissa_end = cursor;
+    exponent = 0;
+    if ((cursor != end) && (*cursor == 'e')) {
+      cursor++;
+      bool negative = false;
+      if ((cursor != end) && ((*cursor == '+') || (*cursor == '-'))) {
+	negative = *cursor == '-';
+	cursor++;
+      }
+      if ((cursor == end) || !is_digit(*cursor)) {
+	return false;
+      }
+      while ((cursor != end) && is_digit(*cursor)) {
+	if (exponent < MAX_EXPONENT) {
+	  exponent = exponent * 10 + (*cursor - '0');
+	}
+	cursor++;
+      }
+      if (negative) {
+	exponent = -exponent;
+      }
+    }
+    return cursor == end;
+  }
+
+  bool match(const char * text, size_t length) {
+    const char * mantissa_end;
+    long exponent;
+    return scan(text, length, mantissa_end, exponent);
+  }
+
+  bool parse(const char * text, size_t length, double & value) {
+    const char * mantissa_end;
+    long exponent;
+    if (!scan(text, length, mantissa_end, exponent)) {
+      return false;
+    }
+    const char * cursor = text;
+    bool negative = false;
+    if ((*cursor == '+') || (*cursor == '-')) {
+      negative = *cursor == '-';
+      cursor++;
+    }
+    const char * mantissa_begin = cursor;
+
+    // Collect the first 19 significant digits, which always fit in 64
+    // bits. Every digit after the point lowers the decimal exponent,
+    // and every integer digit that doesn't fit raises it.
+    uint64_t leading = 0;
+    int significant = 0;
+    long e10 = exponent;
+    bool inexact = false;
+    bool after_dot = false;
+    for (; cursor != mantissa_end; cursor++) {
+      if (*cursor == '.') {
+	after_dot = true;
+	continue;
+      }
+      int digit = *cursor - '0';
+      if ((significant == 0) && (digit == 0)) {
+	if (after_dot) {
+	  e10--;
+	}
+	continue;
+      }
+      if (significant < 19) {
+	leading = leading * 10 + digit;
+	significant++;
+	if (after_dot) {
+	  e10--;
+	}
+      } else {
+	significant++;
+	if (!after_dot) {
+	  e10++;
+	}
+	if (digit != 0) {
+	  inexact = true;
+	}
+      }
+    }
+
+    if (leading == 0) {
+      value = negative ? -0.0 : 0.0;
+      return true;
+    }
+
+    // Clinger's fast path: both the digits and the power of ten are
+    // exact doubles, so one multiply or divide rounds correctly.
+    if (!inexact && (leading <= ((uint64_t) 1 << 53))) {
+      double result = -1;
+      if ((e10 >= 0) && (e10 <= 22)) {
+	result = (double) leading * exact_powers[e10];
+      } else if ((e10 < 0) && (e10 >= -22)) {
+	result = (double) leading / exact_powers[-e10];
+      } else if ((e10 > 22) && (e10 <= 22 + 15)) {
+	uint64_t scaled = leading;
+	bool exact = true;
+	for (long i = 0; (i < e10 - 22) && exact; i++) {
+	  exact = scaled <= ((uint64_t) 1 << 53) / 10;
+	  scaled *= 10;
+	}
+	if (exact) {
+	  result = (double) scaled * exact_powers[22];
+	}
+      }
+      if (result >= 0) {
+	value = negative ? -result : result;
+	return true;
+      }
+    }
+
+    // Out of range in either direction. The value lies in
+    // [10^(magnitude - 1), 10^magnitude).
+    long magnitude = (significant < 19 ? significant : 19) + e10;
+    if (magnitude > 310) {
+      value = negative ? -HUGE_VAL : HUGE_VAL;
+      return true;
+    } else if (magnitude < -323) {
+      value = negative ? -0.0 : 0.0;
+      return true;
+    }
+
+    // The slow path needs every significant digit.
+    BigInt digits;
+    int kept = 0;
+    bool sticky = false;
+    long big_e10 = exponent;
+    after_dot = false;
+    bool seen_nonzero = false;
+    for (cursor = mantissa_begin; cursor != mantissa_end; cursor++) {
+      if (*cursor == '.') {
+	after_dot = true;
+	continue;
+      }
+      int digit = *cursor - '0';
+      seen_nonzero = seen_nonzero || (digit != 0);
+      if (!seen_nonzero) {
+	if (after_dot) {
+	  big_e10--;
+	}
+	continue;
+      }
+      if (kept < MAX_DIGITS) {
+	digits.multiply(10);
+	digits.add(digit);
+	kept++;
+	if (after_dot) {
+	  big_e10--;
+	}
+      } else {
+	if (!after_dot) {
+	  big_e10++;
+	}
+	sticky = sticky || (digit != 0);
+      }
+    }
+    if (sticky) {
+      // Stand in for the dropped digits with one more nonzero digit, so
+      // the value can never look like it sits on a halfway point.
+      digits.multiply(10);
+      digits.add(1);
+      big_e10--;
+    }
+
+    long double guess = (long double) leading * std::pow(10.0L, (long double) e10);
+    value = refine(digits, big_e10, (double) guess);
+    if (negative) {
+      value = -value;
+    }
+    return true;
+  }
+
+}
@@ -0,0 +1,26 @@
+#include <cstddef>
+
+#ifndef NUMBER_H
+#define NUMBER_H
+
+namespace number {
+
+  /*
+   * Return true if the text is a number literal. A literal has an
+   * optional sign, digits with at most one decimal point (which can't
+   * come first), and an optional exponent: an 'e', an optional sign,
+   * and at least one digit. For example "3", "-2.5", "314." and
+   * "6.02e23".
+   */
+  bool match(const char * text, size_t length);
+
+  /*
+   * Parse a number literal into the nearest double, rounding halfway
+   * cases to even. It doesn't allocate and doesn't look at the
+   * locale. Return false if the text isn't a number literal.
+   */
+  bool parse(const char * text, size_t length, double & value);
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+#include "reader.hpp"
+
+#include <string>
+#include <vector>
+#include <istream>
+
+#include "tokenize.hpp"
+#include "number.hpp"
+#include "scan.hpp"
+
+namespace reader {
+
+  Handler::~Handler() {}
+
+  void Handler::on_open(uint64_t) {}
+
+  void Handler::on_atom(token::Type, const char *, size_t, uint64_t) {}
+
+  void Handler::on_close(uint64_t) {}
+
+  void Handler::on_numbers(const double *, size_t, uint64_t) {}
+
+  Options::Options() {
+    this->pack_numbers = false;
+    this->batch_size = 1024;
+    this->chunk_size = 1 << 16;
+  }
+
+  Reader::Reader(Handler & handler, const Options & options) : handler(handler) {
+    this->options = options;
+    if (this->options.batch_size == 0) {
+      this->options.batch_size = 1;
+    }
+    if (this->options.chunk_size == 0) {
+      this->options.chunk_size = 1;
+    }
+    this->state = START;
+    this->consumed = 0;
+    this->depth = 0;
+    this->pending_offset = 0;
+    this->numbers_offset = 0;
+    this->failed = false;
+    this->error_offset = 0;
+    numbers.reserve(this->options.batch_size);
+  }
+
+  bool Reader::fail(uint64_t offset, const std::string & message) {
+    failed = true;
+    error = message;
+    error_offset = offset;
+    return false;
+  }
+
+  void Reader::flush() {
+    if (!numbers.empty()) {
+      handler.on_numbers(numbers.data(), numbers.size(), numbers_offset);
+      numbers.clear();
+    }
+  }
+
+  bool Reader::atom(const char * text, size_t length, uint64_t offset) {
+    double value;
+    if (options.pack_numbers && number::parse(text, length, value)) {
+      if (numbers.empty()) {
+	numbers_offset = offset;
+      }
+      numbers.push_back(value);
+      if (numbers.size() == options.batch_size) {
+	flush();
+      }
+      return true;
+    }
+    token::Type kind = token::classify(text, length);
+    if (kind == token::ATOM) {
+      return fail(offset, "invalid atom '" + std::string(text, length) + "'");
+    }
+    flush();
+    handler.on_atom(kind, text, length, offset);
+    return true;
+  }
+
+  bool Reader::feed(const char * data, size_t size) {
+    if (failed) {
+      return false;
+    }
+    const char * cursor = data;
+    const char * end = data + size;
+    // Finish whatever the last piece left off in the middle of.
+    switch (state) {
+    case COMMENT:
+      cursor = scan::find_newline(cursor, end);
+      if (cursor == end) {
+	consumed += size;
+	return true;
+      }
+      cursor++;
+      break;
+    case SPACE:
+      {
+	size_t lines = 0;
+	cursor = scan::skip_space(cursor, end, lines);
+	if (cursor == end) {
+	  consumed += size;
+	  return true;
+	}
+	break;
+      }
+    case ATOM:
+      cursor = scan::find_delimiter(cursor, end);
+      pending.append(data, cursor - data);
+      if (cursor == end) {
+	consumed += size;
+	return true;
+      }
+      if (!atom(pending.data(), pending.size(), pending_offset)) {
+	return false;
+      }
+      pending.clear();
+      break;
+    case START:
+      break;
+    }
+    state = START;
+
+    while (cursor != end) {
+      switch (*cursor) {
+      case '(':
+	flush();
+	handler.on_open(consumed + (cursor - data));
+	depth++;
+	cursor++;
+	break;
+      case ')':
+	if (depth == 0) {
+	  return fail(consumed + (cursor - data), "unmatched ')'");
+	}
+	flush();
+	handler.on_close(consumed + (cursor - data));
+	depth--;
+	cursor++;
+	break;
+      case ';':
+	cursor = scan::find_newline(cursor, end);
+	if (cursor == end) {
+	  state = COMMENT;
+	} else {
+	  cursor++;
+	}
+	break;
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n':
+	{
+	  size_t lines = 0;
+	  cursor = scan::skip_space(cursor, end, lines);
+	  if (cursor == end) {
+	    state = SPACE;
+	  }
+	  break;
+	}
+      default:
+	{
+	  const char * start = cursor;
+	  cursor = scan::find_delimiter(cursor, end);
+	  if (cursor == end) {
+	    state = ATOM;
+	    pending.assign(start, cursor - start);
+	    pending_offset = consumed + (start - data);
+	  } else if (!atom(start, cursor - start, consumed + (start - data))) {
+	    return false;
+	  }
+	}
+      }
+    }
+    consumed += size;
+    return true;
+  }
+
+  bool Reader::finish() {
+    if (failed) {
+      return false;
+    }
+    if (state == ATOM) {
+      if (!atom(pending.data(), pending.size(), pending_offset)) {
+	return false;
+      }
+      pending.clear();
+    }
+    state = START;
+    if (depth != 0) {
+      return fail(consumed, "missing ')' at the end of the input");
+    }
+    flush();
+    return true;
+  }
+
+  bool Reader::read(const char * data, size_t size) {
+    return feed(data, size) && finish();
+  }
+
+  bool Reader::read(std::istream & stream) {
+    std::vector<char> chunk(options.chunk_size);
+    while (stream) {
+      stream.read(chunk.data(), chunk.size());
+      if ((stream.gcount() > 0) && !feed(chunk.data(), stream.gcount())) {
+	return false;
+      }
+    }
+    return finish();
+  }
+
+  uint64_t Reader::getOffset() const {
+    return consumed;
+  }
+
+  uint64_t Reader::getDepth() const {
+    return depth;
+  }
+
+  const std::string & Reader::getError() const {
+    return error;
+  }
+
+  uint64_t Reader::getErrorOffset() const {
+    return error_offset;
+  }
+
+}
@@ -0,0 +1,90 @@
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+
+#include "tokenize.hpp"
+
+#ifndef READER_H
+#define READER_H
+
+namespace reader {
+
+  /*
+   * Gets told about the syntax as it's read, for using the s-expression
+   * syntax as a data format without building a tree. Offsets are byte
+   * offsets from the start of the input and are 64 bits, so inputs can
+   * be bigger than 4 GB. The text of an atom is only valid during the
+   * call. All of the calls do nothing unless they're overridden.
+   */
+  class Handler {
+  public:
+    virtual ~Handler();
+    virtual void on_open(uint64_t offset);
+    // kind is NUMBER, BOOL, NONE or SYMBOL.
+    virtual void on_atom(token::Type kind, const char * text, size_t length, uint64_t offset);
+    virtual void on_close(uint64_t offset);
+    // A run of number atoms with no other atom or paren between them,
+    // already parsed, so a run never spans lists but top-level numbers
+    // are packed too. offset is where the first one starts. Only called
+    // if pack_numbers is set, and then in place of on_atom.
+    virtual void on_numbers(const double * values, size_t count, uint64_t offset);
+  };
+
+  /*
+   * Settings for a Reader. If pack_numbers is set, runs of numbers are
+   * handed over in batches of up to batch_size through on_numbers.
+   * chunk_size is how much of a stream is read at a time.
+   */
+  struct Options {
+    Options();
+    bool pack_numbers;
+    size_t batch_size;
+    size_t chunk_size;
+  };
+
+  /*
+   * Reads the syntax the lexer accepts and turns it into handler calls,
+   * without ever holding more than one atom, one batch of numbers and
+   * a paren count. Input can come in pieces of any size through feed,
+   * followed by finish, or all at once through read. Any number of
+   * top-level forms is fine and so is "()", because data isn't a
+   * program. Reading stops at the first error: a stray ')', an atom
+   * that isn't valid (like "1abc") or a list that's never closed. The
+   * error is kept for getError and getErrorOffset.
+   */
+  class Reader {
+  public:
+    Reader(Handler & handler, const Options & options = Options());
+    bool feed(const char * data, size_t size);
+    bool finish();
+    bool read(const char * data, size_t size);
+    bool read(std::istream & stream);
+    uint64_t getOffset() const;
+    uint64_t getDepth() const;
+    const std::string & getError() const;
+    uint64_t getErrorOffset() const;
+  private:
+    enum State { START, SPACE, COMMENT, ATOM };
+    bool atom(const char * text, size_t length, uint64_t offset);
+    void flush();
+    bool fail(uint64_t offset, const std::string & message);
+    Handler & handler;
+    Options options;
+    State state;
+    uint64_t consumed;
+    uint64_t depth;
+    // An atom cut in two by the end of a piece.
+    std::string pending;
+    uint64_t pending_offset;
+    std::vector<double> numbers;
+    uint64_t numbers_offset;
+    bool failed;
+    std::string error;
+    uint64_t error_offset;
+  };
+
+}
+
+#endif
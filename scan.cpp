@@ -0,0 +1,326 @@
+#include "scan.hpp"
+
+#include <atomic>
+#include <cstddef>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace scan {
+
+  static inline bool is_delimiter(char c) {
+    switch (c) {
+    case '(':
+    case ')':
+    case ';':
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  static inline bool is_space(char c) {
+    return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+  }
+
+  /*
+   * The scalar kernels. The vector kernels use them for the tail end
+   * of the buffer that doesn't fill a whole block.
+   */
+  static const char * find_delimiter_scalar(const char * begin, const char * end) {
+    while ((begin != end) && !is_delimiter(*begin)) {
+      begin++;
+    }
+    return begin;
+  }
+
+  static const char * find_newline_scalar(const char * begin, const char * end) {
+    while ((begin != end) && (*begin != '\n')) {
+      begin++;
+    }
+    return begin;
+  }
+
+  static const char * skip_space_scalar(const char * begin, const char * end, size_t & lines) {
+    while ((begin != end) && is_space(*begin)) {
+      if (*begin == '\n') {
+	lines++;
+      }
+      begin++;
+    }
+    return begin;
+  }
+
+  static size_t count_newlines_scalar(const char * begin, const char * end) {
+    size_t lines = 0;
+    while (begin != end) {
+      if (*begin++ == '\n') {
+	lines++;
+      }
+    }
+    return lines;
+  }
+
+#ifdef SCAN_X86
+  /*
+   * SSE2 kernels, 16 bytes at a time. Every block is classified with
+   * a handful of byte compares and squashed down to a bit mask.
+   */
+  static inline __m128i delimiters_sse2(__m128i block) {
+    // '(' and ')' only differ in their lowest bit.
+    __m128i parens = _mm_cmpeq_epi8(_mm_and_si128(block, _mm_set1_epi8((char) 0xFE)),
+				    _mm_set1_epi8('('));
+    __m128i hits = _mm_or_si128(parens, _mm_cmpeq_epi8(block, _mm_set1_epi8(';')));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(' ')));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8('\t')));
+    hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8('\r')));
+    return _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8('\n')));
+  }
+
+  static inline __m128i spaces_sse2(__m128i block) {
+    // '\t' through '\r' is a range, so shift it down to 0-4 and do an
+    // unsigned compare.
+    __m128i shifted = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+    __m128i range = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+    return _mm_or_si128(range, _mm_cmpeq_epi8(block, _mm_set1_epi8(' ')));
+  }
+
+  static const char * find_delimiter_sse2(const char * begin, const char * end) {
+    while (end - begin >= 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+      unsigned mask = _mm_movemask_epi8(delimiters_sse2(block));
+      if (mask != 0) {
+	return begin + __builtin_ctz(mask);
+      }
+      begin += 16;
+    }
+    return find_delimiter_scalar(begin, end);
+  }
+
+  static const char * find_newline_sse2(const char * begin, const char * end) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - begin >= 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+      unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+      if (mask != 0) {
+	return begin + __builtin_ctz(mask);
+      }
+      begin += 16;
+    }
+    return find_newline_scalar(begin, end);
+  }
+
+  static const char * skip_space_sse2(const char * begin, const char * end, size_t & lines) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - begin >= 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+      unsigned spaces = _mm_movemask_epi8(spaces_sse2(block));
+      unsigned newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+      if (spaces != 0xFFFF) {
+	unsigned stop = __builtin_ctz(~spaces);
+	lines += __builtin_popcount(newlines & ((1u << stop) - 1));
+	return begin + stop;
+      }
+      lines += __builtin_popcount(newlines);
+      begin += 16;
+    }
+    return skip_space_scalar(begin, end, lines);
+  }
+
+  static size_t count_newlines_sse2(const char * begin, const char * end) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t lines = 0;
+    while (end - begin >= 16) {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+      lines += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+      begin += 16;
+    }
+    return lines + count_newlines_scalar(begin, end);
+  }
+
+  /*
+   * AVX2 kernels, 32 bytes at a time. They're compiled for AVX2 even
+   * when the rest of the program isn't, and only get called after the
+   * processor says it supports them.
+   */
+#define SCAN_AVX2 __attribute__((target("avx2,popcnt,bmi")))
+
+  SCAN_AVX2 static inline __m256i delimiters_avx2(__m256i block) {
+    __m256i parens = _mm256_cmpeq_epi8(_mm256_and_si256(block, _mm256_set1_epi8((char) 0xFE)),
+				       _mm256_set1_epi8('('));
+    __m256i hits = _mm256_or_si256(parens, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(';')));
+    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')));
+    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\t')));
+    hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\r')));
+    return _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, _mm256_set1_epi8('\n')));
+  }
+
+  SCAN_AVX2 static inline __m256i spaces_avx2(__m256i block) {
+    __m256i shifted = _mm256_sub_epi8(block, _mm256_set1_epi8('\t'));
+    __m256i range = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8(4)), shifted);
+    return _mm256_or_si256(range, _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' ')));
+  }
+
+  SCAN_AVX2 static const char * find_delimiter_avx2(const char * begin, const char * end) {
+    while (end - begin >= 32) {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+      unsigned mask = _mm256_movemask_epi8(delimiters_avx2(block));
+      if (mask != 0) {
+	return begin + __builtin_ctz(mask);
+      }
+      begin += 32;
+    }
+    return find_delimiter_sse2(begin, end);
+  }
+
+  SCAN_AVX2 static const char * find_newline_avx2(const char * begin, const char * end) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    while (end - begin >= 32) {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+      unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+      if (mask != 0) {
+	return begin + __builtin_ctz(mask);
+      }
+      begin += 32;
+    }
+    return find_newline_sse2(begin, end);
+  }
+
+  SCAN_AVX2 static const char * skip_space_avx2(const char * begin, const char * end, size_t & lines) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    while (end - begin >= 32) {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+      unsigned spaces = _mm256_movemask_epi8(spaces_avx2(block));
+      unsigned newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+      if (spaces != 0xFFFFFFFFu) {
+	unsigned stop = __builtin_ctz(~spaces);
+	lines += __builtin_popcount(newlines & ((1u << stop) - 1));
+	return begin + stop;
+      }
+      lines += __builtin_popcount(newlines);
+      begin += 32;
+    }
+    return skip_space_sse2(begin, end, lines);
+  }
+
+  SCAN_AVX2 static size_t count_newlines_avx2(const char * begin, const char * end) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t lines = 0;
+    while (end - begin >= 32) {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(begin));
+      lines += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+      begin += 32;
+    }
+    return lines + count_newlines_sse2(begin, end);
+  }
+#endif
+
+  /*
+   * One set of kernels per mode. The lexer calls through whichever set
+   * is current.
+   */
+  struct Kernels {
+    Mode mode;
+    const char * (*find_delimiter)(const char *, const char *);
+    const char * (*find_newline)(const char *, const char *);
+    const char * (*skip_space)(const char *, const char *, size_t &);
+    size_t (*count_newlines)(const char *, const char *);
+  };
+
+  static const Kernels scalar_kernels = {
+    SCALAR,
+    find_delimiter_scalar,
+    find_newline_scalar,
+    skip_space_scalar,
+    count_newlines_scalar
+  };
+
+#ifdef SCAN_X86
+  static const Kernels sse2_kernels = {
+    SSE2,
+    find_delimiter_sse2,
+    find_newline_sse2,
+    skip_space_sse2,
+    count_newlines_sse2
+  };
+
+  static const Kernels avx2_kernels = {
+    AVX2,
+    find_delimiter_avx2,
+    find_newline_avx2,
+    skip_space_avx2,
+    count_newlines_avx2
+  };
+#endif
+
+  static std::atomic<const Kernels *> current(nullptr);
+
+  static const Kernels * kernels_for(Mode mode) {
+    switch (mode) {
+#ifdef SCAN_X86
+    case AVX2:
+      return __builtin_cpu_supports("avx2") ? &avx2_kernels : nullptr;
+    case SSE2:
+      return &sse2_kernels;
+#endif
+    case SCALAR:
+      return &scalar_kernels;
+    default:
+      return nullptr;
+    }
+  }
+
+  static inline const Kernels & kernels() {
+    const Kernels * selected = current.load(std::memory_order_relaxed);
+    if (selected == nullptr) {
+      selected = kernels_for(best_mode());
+      current.store(selected, std::memory_order_relaxed);
+    }
+    return *selected;
+  }
+
+  Mode best_mode() {
+    if (kernels_for(AVX2) != nullptr) {
+      return AVX2;
+    } else if (kernels_for(SSE2) != nullptr) {
+      return SSE2;
+    }
+    return SCALAR;
+  }
+
+  Mode get_mode() {
+    return kernels().mode;
+  }
+
+  bool set_mode(Mode mode) {
+    const Kernels * selected = kernels_for(mode);
+    if (selected == nullptr) {
+      return false;
+    }
+    current.store(selected, std::memory_order_relaxed);
+    return true;
+  }
+
+  const char * find_delimiter(const char * begin, const char * end) {
+    return kernels().find_delimiter(begin, end);
+  }
+
+  const char * find_newline(const char * begin, const char * end) {
+    return kernels().find_newline(begin, end);
+  }
+
+  const char * skip_space(const char * begin, const char * end, size_t & lines) {
+    return kernels().skip_space(begin, end, lines);
+  }
+
+  size_t count_newlines(const char * begin, const char * end) {
+    return kernels().count_newlines(begin, end);
+  }
+
+}
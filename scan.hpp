@@ -0,0 +1,49 @@
+#include <cstddef>
+
+#ifndef SCAN_H
+#define SCAN_H
+
+namespace scan {
+
+  /*
+   * The scanning kernels the lexer can run on. SSE2 is always there
+   * on x86-64 and AVX2 is used when the processor has it. SCALAR is
+   * the plain byte loop, and it's the only choice on other machines.
+   */
+  enum Mode { SCALAR, SSE2, AVX2 };
+
+  /*
+   * Return the first character in [begin, end) that ends an atom: a
+   * paren, a semicolon, a space, a tab, a carriage return or a
+   * newline. Return end if there isn't one.
+   */
+  const char * find_delimiter(const char * begin, const char * end);
+
+  /*
+   * Return the first newline in [begin, end), or end.
+   */
+  const char * find_newline(const char * begin, const char * end);
+
+  /*
+   * Skip a run of whitespace (everything isspace accepts) starting at
+   * begin and return the first character after it. The newlines in the
+   * run are added to lines.
+   */
+  const char * skip_space(const char * begin, const char * end, size_t & lines);
+
+  /*
+   * Count the newlines in [begin, end).
+   */
+  size_t count_newlines(const char * begin, const char * end);
+
+  /*
+   * The mode picked at startup is the best one the processor
+   * supports. set_mode returns false if the mode isn't supported.
+   */
+  Mode get_mode();
+  Mode best_mode();
+  bool set_mode(Mode mode);
+
+}
+
+#endif
@@ -0,0 +1,246 @@
+#include "source.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "scan.hpp"
+
+namespace source {
+
+  Buffer::Buffer() {
+    this->data = "";
+    this->size = 0;
+    this->mapping = nullptr;
+  }
+
+  Buffer::~Buffer() {
+    release();
+  }
+
+  void Buffer::release() {
+    if (mapping != nullptr) {
+      munmap(mapping, size);
+      mapping = nullptr;
+    }
+    fallback.clear();
+    data = "";
+    size = 0;
+  }
+
+  bool Buffer::open(const std::string & path) {
+    release();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      close(fd);
+      return false;
+    }
+    if (S_ISDIR(info.st_mode)) {
+      close(fd);
+      return false;
+    }
+    if (S_ISREG(info.st_mode) && (info.st_size > 0)) {
+      void * pages = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (pages != MAP_FAILED) {
+	// The lexer only ever walks forward, so let the kernel read ahead.
+	madvise(pages, info.st_size, MADV_SEQUENTIAL);
+	close(fd);
+	mapping = pages;
+	data = static_cast<const char *>(pages);
+	size = info.st_size;
+	return true;
+      }
+    }
+    // Couldn't map it, so fall back on plain reads.
+    bool ok = read(fd);
+    close(fd);
+    return ok;
+  }
+
+  bool Buffer::read(int fd) {
+    release();
+    char chunk[1 << 16];
+    while (true) {
+      ssize_t count = ::read(fd, chunk, sizeof(chunk));
+      if (count == 0) {
+	break;
+      } else if (count < 0) {
+	if (errno == EINTR) {
+	  continue;
+	}
+	fallback.clear();
+	return false;
+      }
+      fallback.append(chunk, count);
+    }
+    data = fallback.data();
+    size = fallback.size();
+    return true;
+  }
+
+  const char * Buffer::getData() const {
+    return data;
+  }
+
+  size_t Buffer::getSize() const {
+    return size;
+  }
+
+  bool Buffer::isMapped() const {
+    return mapping != nullptr;
+  }
+
+  LineIndex::LineIndex(const char * data, size_t size) {
+    const char * end = data + size;
+    starts.reserve(scan::count_newlines(data, end) + 1);
+    starts.push_back(0);
+    const char * cursor = scan::find_newline(data, end);
+    while (cursor != end) {
+      cursor++;
+      starts.push_back(cursor - data);
+      cursor = scan::find_newline(cursor, end);
+    }
+  }
+
+  Position LineIndex::locate(uint32_t offset) const {
+    // The line is the last one that starts at or before the offset.
+    std::vector<uint32_t>::const_iterator line =
+      std::upper_bound(starts.begin(), starts.end(), offset) - 1;
+    Position position;
+    position.line = (line - starts.begin()) + 1;
+    position.column = (offset - *line) + 1;
+    return position;
+  }
+
+  size_t LineIndex::getLineCount() const {
+    return starts.size();
+  }
+
+  FormReader::FormReader(std::istream & stream) {
+    this->buffer = stream.rdbuf();
+    this->consumed = 0;
+    this->current.line = 1;
+    this->current.column = 1;
+    this->form_offset = 0;
+    this->form_position = current;
+  }
+
+  uint64_t FormReader::getOffset() const {
+    return form_offset;
+  }
+
+  Position FormReader::getPosition() const {
+    return form_position;
+  }
+
+  int FormReader::take() {
+    int c = buffer->sbumpc();
+    if (c == std::char_traits<char>::eof()) {
+      return c;
+    }
+    consumed++;
+    if (c == '\n') {
+      current.line++;
+      current.column = 1;
+    } else {
+      current.column++;
+    }
+    return c;
+  }
+
+  /*
+   * Return true if c ends an atom, the same set scan::find_delimiter
+   * looks for.
+   */
+  static bool is_delimiter(int c) {
+    switch (c) {
+    case '(':
+    case ')':
+    case ';':
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  bool FormReader::next(std::string & form) {
+    const int eof = std::char_traits<char>::eof();
+    form.clear();
+    // Skip to the start of the next form. Like the lexer, a run of
+    // whitespace only starts at a space, tab, carriage return or
+    // newline, but once inside one it also takes \v and \f.
+    bool space = false;
+    int c;
+    while (true) {
+      c = buffer->sgetc();
+      if (c == eof) {
+	return false;
+      }
+      if ((c == ' ') || (c == '\t') || (c == '\r') || (c == '\n')) {
+	space = true;
+      } else if (space && ((c == '\v') || (c == '\f'))) {
+	// Still in the run.
+      } else if (c == ';') {
+	space = false;
+	while ((c != eof) && (c != '\n')) {
+	  c = take();
+	}
+	continue;
+      } else {
+	break;
+      }
+      take();
+    }
+
+    form_offset = consumed;
+    form_position = current;
+    if (c == ')') {
+      form.push_back(take());
+      return true;
+    }
+    if (c != '(') {
+      // An atom runs up to the next delimiter, which is left for the
+      // next form.
+      while ((c != eof) && !is_delimiter(c)) {
+	form.push_back(take());
+	c = buffer->sgetc();
+      }
+      return true;
+    }
+    // A list runs to the paren that closes it, or to the end of the
+    // stream if it's never closed. Parens in comments don't count.
+    size_t depth = 0;
+    bool comment = false;
+    while ((c = take()) != eof) {
+      form.push_back(c);
+      if (comment) {
+	comment = c != '\n';
+      } else if (c == ';') {
+	comment = true;
+      } else if (c == '(') {
+	depth++;
+      } else if (c == ')') {
+	depth--;
+	if (depth == 0) {
+	  break;
+	}
+      }
+    }
+    return true;
+  }
+
+}
@@ -0,0 +1,84 @@
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+namespace source {
+
+  /*
+   * A read-only view of a whole script. Regular files are memory
+   * mapped so the lexer can work straight off the page cache. Pipes,
+   * terminals and other things that can't be mapped are read into a
+   * buffer instead.
+   */
+  class Buffer {
+  public:
+    Buffer();
+    ~Buffer();
+    bool open(const std::string & path);
+    bool read(int fd);
+    const char * getData() const;
+    size_t getSize() const;
+    bool isMapped() const;
+  private:
+    Buffer(const Buffer & other) = delete;
+    Buffer & operator=(const Buffer & other) = delete;
+    void release();
+    const char * data;
+    size_t size;
+    void * mapping;
+    std::string fallback;
+  };
+
+  /*
+   * A line and a column, both counted from 1.
+   */
+  struct Position {
+    size_t line;
+    size_t column;
+  };
+
+  /*
+   * Turns the byte offsets carried by tokens, expressions and errors
+   * into lines and columns. Building it takes one bulk pass over the
+   * buffer to find where each line starts. Lookups are a binary search.
+   * Nothing keeps line numbers around until a diagnostic needs one.
+   */
+  class LineIndex {
+  public:
+    LineIndex(const char * data, size_t size);
+    Position locate(uint32_t offset) const;
+    size_t getLineCount() const;
+  private:
+    std::vector<uint32_t> starts;
+  };
+
+  /*
+   * Cuts a stream into top-level forms, one at a time, so a script can
+   * be run while it's still being read. A form is a whole list or a
+   * single atom. A stray close paren comes back as a form of its own,
+   * so the parser can report it. Whitespace and comments between forms
+   * are dropped. Only the current form is ever held in memory.
+   */
+  class FormReader {
+  public:
+    FormReader(std::istream & stream);
+    bool next(std::string & form);
+    uint64_t getOffset() const;
+    Position getPosition() const;
+  private:
+    int take();
+    std::streambuf * buffer;
+    uint64_t consumed;
+    Position current;
+    uint64_t form_offset;
+    Position form_position;
+  };
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#include "symbol.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <cstring>
+#include <cstdint>
+
+#include "fnv.hpp"
+
+namespace symbol {
+
+  /*
+   * The table is open addressing over a power of two number of slots,
+   * kept at most half full. The Symbols themselves live in a deque, so
+   * they never move when it grows.
+   */
+  struct Table {
+    Table() : slots(1024, nullptr) {}
+    std::mutex lock;
+    std::deque<Symbol> symbols;
+    std::vector<const Symbol *> slots;
+  };
+
+  static Table & table() {
+    // Never destroyed, so symbols outlive every static that holds one.
+    static Table * instance = new Table();
+    return *instance;
+  }
+
+  static size_t find(const std::vector<const Symbol *> & slots, const char * text, size_t length,
+		     uint64_t key) {
+    size_t mask = slots.size() - 1;
+    size_t slot = key & mask;
+    while (slots[slot] != nullptr) {
+      const std::string & name = slots[slot]->name;
+      if ((name.size() == length) && (std::memcmp(name.data(), text, length) == 0)) {
+	break;
+      }
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  const Symbol * intern(const char * text, size_t length) {
+    Table & symbols = table();
+    uint64_t key = fnv::hash(text, length);
+    std::lock_guard<std::mutex> guard(symbols.lock);
+    size_t slot = find(symbols.slots, text, length, key);
+    if (symbols.slots[slot] != nullptr) {
+      return symbols.slots[slot];
+    }
+    Symbol symbol;
+    symbol.name.assign(text, length);
+    symbol.id = symbols.symbols.size();
+    symbol.opcode = builtin::lookup(text, length);
+    symbols.symbols.push_back(std::move(symbol));
+    const Symbol * added = &symbols.symbols.back();
+    if (2 * symbols.symbols.size() > symbols.slots.size()) {
+      std::vector<const Symbol *> grown(2 * symbols.slots.size(), nullptr);
+      for (auto const * entry : symbols.slots) {
+	if (entry != nullptr) {
+	  const std::string & name = entry->name;
+	  uint64_t entry_key = fnv::hash(name.data(), name.size());
+	  grown[find(grown, name.data(), name.size(), entry_key)] = entry;
+	}
+      }
+      symbols.slots.swap(grown);
+      slot = find(symbols.slots, text, length, key);
+    }
+    symbols.slots[slot] = added;
+    return added;
+  }
+
+  const Symbol * intern(const std::string & name) {
+    return intern(name.data(), name.size());
+  }
+
+  const Symbol * lookup(const char * text, size_t length) {
+    Table & symbols = table();
+    uint64_t key = fnv::hash(text, length);
+    std::lock_guard<std::mutex> guard(symbols.lock);
+    return symbols.slots[find(symbols.slots, text, length, key)];
+  }
+
+  const Symbol * lookup(const std::string & name) {
+    return lookup(name.data(), name.size());
+  }
+
+  const std::string & name(SymbolId id) {
+    Table & symbols = table();
+    std::lock_guard<std::mutex> guard(symbols.lock);
+    return symbols.symbols.at(id).name;
+  }
+
+  size_t count() {
+    Table & symbols = table();
+    std::lock_guard<std::mutex> guard(symbols.lock);
+    return symbols.symbols.size();
+  }
+
+}
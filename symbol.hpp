@@ -0,0 +1,58 @@
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#include "builtin.hpp"
+
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+namespace symbol {
+
+  /*
+   * The number of an interned name. NO_SYMBOL is never handed out.
+   */
+  typedef uint32_t SymbolId;
+  const SymbolId NO_SYMBOL = UINT32_MAX;
+
+  /*
+   * An interned symbol. There's only ever one Symbol for each name, so
+   * symbols can be compared by address, and it lives until the program
+   * exits. ids count up from 0 in the order names are first seen.
+   * opcode is the builtin the name calls, looked up once when the
+   * name is interned.
+   */
+  struct Symbol {
+    std::string name;
+    SymbolId id;
+    builtin::Opcode opcode;
+  };
+
+  /*
+   * Return the Symbol for a name, adding it the first time. A name
+   * that's already there is found without allocating. It's safe to
+   * call from several threads.
+   */
+  const Symbol * intern(const char * text, size_t length);
+  const Symbol * intern(const std::string & name);
+
+  /*
+   * Return the Symbol for a name if it has been interned, or nullptr.
+   * Nothing is ever added.
+   */
+  const Symbol * lookup(const char * text, size_t length);
+  const Symbol * lookup(const std::string & name);
+
+  /*
+   * Return the name of an interned id.
+   */
+  const std::string & name(SymbolId id);
+
+  /*
+   * How many different names have been interned.
+   */
+  size_t count();
+
+}
+
+#endif
@@ -4,6 +4,9 @@
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
 
 #include "interpreter_semantic_error.hpp"
 #include "interpreter.hpp"
@@ -13,6 +16,7 @@
 #define TOKENIZE "[Tokenize]"
 
 #include "tokenize.hpp"
+#include "source.hpp"
 
 using token::Token;
 using token::tokenize;
@@ -123,6 +127,165 @@ TEST_CASE("Test single value.", TOKENIZE) {
   REQUIRE(tokens == expected);
 }
 
+// The stream tokenizer doesn't classify atoms, so fold the atom kinds
+// back into ATOM to compare the two.
+std::list<Token> tokenize_buffer(const std::string & text) {
+  std::list<Token> tokens;
+  source::LineIndex lines(text.data(), text.size());
+  for (auto view : tokenize(text.data(), text.size())) {
+    if ((view.type != OPEN_PAREN) && (view.type != CLOSE_PAREN)) {
+      view.type = ATOM;
+    }
+    size_t line = lines.locate(view.offset).line;
+    tokens.push_back(token::to_token(view, text.data(), line));
+  }
+  return tokens;
+}
+
+TEST_CASE("Test buffer tokenizer matches stream tokenizer.", TOKENIZE) {
+  std::vector<std::string> programs = {
+    "",
+    "(+ 12 34 (* 56 78))",
+    "  \r\n\t  abc\n\ndef\t\tghi",
+    "abc ;\n efg\nghi;asdasd asdasd\n",
+    "(a\n\v\fb)\fc ; trailing",
+    "(begin\n (define a 1)\n (if (< a 2) a 3))"
+  };
+  for (auto & program : programs) {
+    std::stringstream stream(program);
+    REQUIRE(tokenize_buffer(program) == tokenize(stream));
+  }
+}
+
+TEST_CASE("Test buffer tokenizer views.", TOKENIZE) {
+  std::string text = "(abc\n 12)";
+  std::vector<token::TokenView> views = tokenize(text.data(), text.size());
+  REQUIRE(views.size() == 4);
+  REQUIRE(views[1].type == token::SYMBOL);
+  REQUIRE(views[1].offset == 1);
+  REQUIRE(views[1].length == 3);
+  REQUIRE(views[2].offset == 6);
+}
+
+TEST_CASE("Test line index.", TOKENIZE) {
+  std::string text = "(abc\n 12\n\n  x)";
+  source::LineIndex lines(text.data(), text.size());
+  REQUIRE(lines.getLineCount() == 4);
+  REQUIRE(lines.locate(0).line == 1);
+  REQUIRE(lines.locate(0).column == 1);
+  REQUIRE(lines.locate(4).line == 1);
+  REQUIRE(lines.locate(6).line == 2);
+  REQUIRE(lines.locate(6).column == 2);
+  REQUIRE(lines.locate(12).line == 4);
+  REQUIRE(lines.locate(12).column == 3);
+}
+
+TEST_CASE("Test buffer tokenizer classifies atoms.", TOKENIZE) {
+  std::string text = "(f True False None 12 -3.5 + - abc 1abc)";
+  std::vector<token::Type> expected = {
+    OPEN_PAREN, token::SYMBOL, token::BOOL, token::BOOL, token::NONE,
+    token::NUMBER, token::NUMBER, token::SYMBOL, token::SYMBOL,
+    token::SYMBOL, ATOM, CLOSE_PAREN
+  };
+  std::vector<token::Type> types;
+  for (auto & view : tokenize(text.data(), text.size())) {
+    types.push_back(view.type);
+  }
+  REQUIRE(types == expected);
+}
+
+#include "scan.hpp"
+
+std::string scan_test_input() {
+  // Long atoms, whitespace runs and comments that straddle the 16 and
+  // 32 byte blocks of the vector kernels.
+  const char * pieces[] = {
+    "(", ")", " ", "\t", "\r\n", "\n", "\v", "\f", "; note (x)\n",
+    "abc", "12.5e3", "a-very-long-symbol-name-that-crosses-blocks",
+    "                                      ", "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n"
+  };
+  const size_t count = sizeof(pieces) / sizeof(pieces[0]);
+  std::string text;
+  unsigned state = 12345;
+  for (int i = 0; i < 2000; i++) {
+    state = state * 1103515245 + 12345;
+    text += pieces[(state >> 16) % count];
+  }
+  return text;
+}
+
+TEST_CASE("Test scanning kernels produce identical token streams.", TOKENIZE) {
+  std::string text = scan_test_input();
+  std::stringstream stream(text);
+  std::list<Token> expected = tokenize(stream);
+
+  scan::Mode original = scan::get_mode();
+  std::vector<scan::Mode> modes = {scan::SCALAR, scan::SSE2, scan::AVX2};
+  for (auto mode : modes) {
+    if (!scan::set_mode(mode)) {
+      continue;
+    }
+    REQUIRE(scan::get_mode() == mode);
+    REQUIRE(tokenize_buffer(text) == expected);
+    for (size_t start = 0; start < 64; start++) {
+      const char * begin = text.data() + start;
+      const char * end = text.data() + text.size();
+      size_t lines = 0;
+      REQUIRE(scan::count_newlines(begin, end) ==
+	      (size_t) std::count(begin, end, '\n'));
+      const char * stop = scan::skip_space(begin, end, lines);
+      REQUIRE(lines == (size_t) std::count(begin, stop, '\n'));
+      REQUIRE(scan::find_newline(begin, end) == std::find(begin, end, '\n'));
+    }
+  }
+  scan::set_mode(original);
+}
+
+TEST_CASE("Test parallel tokenizer matches sequential tokenizer.", TOKENIZE) {
+  std::string text = "(begin\n";
+  for (int i = 0; i < 3000; i++) {
+    text += "  (define v" + std::to_string(i) + " (+ " + std::to_string(i) + " 1.5)) ; n\n";
+    if (i % 7 == 0) {
+      text += "\n\v\f v0\t(- 1)\n";
+    }
+  }
+  text += ")\n";
+  std::string program = text;
+  text += scan_test_input();
+
+  std::stringstream stream(text);
+  std::list<Token> expected = tokenize(stream);
+
+  token::ParallelOptions options;
+  options.threshold = 0;
+  options.threads = 4;
+  std::vector<token::Chunk> chunks;
+  std::vector<token::TokenView> tokens = token::tokenize_parallel(text.data(), text.size(),
+								  options, &chunks);
+  REQUIRE(chunks.size() > 1);
+  REQUIRE(chunks.front().depth == 0);
+  REQUIRE(chunks[1].depth == 1);
+  REQUIRE(tokens.size() == tokenize(text.data(), text.size()).size());
+
+  std::list<Token> stitched;
+  source::LineIndex lines(text.data(), text.size());
+  for (auto view : tokens) {
+    if ((view.type != OPEN_PAREN) && (view.type != CLOSE_PAREN)) {
+      view.type = ATOM;
+    }
+    stitched.push_back(token::to_token(view, text.data(), lines.locate(view.offset).line));
+  }
+  REQUIRE(stitched == expected);
+
+  Interpreter interp;
+  interp.setParallelOptions(options);
+  REQUIRE(interp.parse(program.data(), program.size()));
+  REQUIRE(interp.eval() == Expression(2999 + 1.5));
+  std::string truncated = program.substr(0, program.size() - 2);
+  REQUIRE_FALSE(interp.parse(truncated.data(), truncated.size()));
+  REQUIRE(interp.getErrorOffset() == truncated.size());
+}
+
 #define EXPRESSION "[Expression]"
 #define MATCH "[MATCH]"
 #define PARSE "[PARSE]"
@@ -327,6 +490,31 @@ TEST_CASE("Simple value.", PARSE) {
 }
 
 
+TEST_CASE("Parse straight from a lexer.", PARSE) {
+  std::string text = "(+ (- pi 1.5) 3)";
+  token::Lexer lexer(text.data(), text.size());
+  std::vector<Expression> deep_children = {
+    Expression(std::string("-")),
+    Expression(std::string("pi")),
+    Expression(1.5 * 1.0)
+  };
+  std::vector<Expression> shallow_children = {
+    Expression(std::string("+")),
+    Expression(deep_children),
+    Expression(3 * 1.0)
+  };
+  REQUIRE(parse_tokens(lexer) == Expression(shallow_children));
+
+  std::string extra = "(+ 1 2) 3";
+  token::Lexer extra_lexer(extra.data(), extra.size());
+  REQUIRE_THROWS_AS(parse_tokens(extra_lexer), InvalidTokenException);
+
+  std::string bare = "abc";
+  token::Lexer bare_lexer(bare.data(), bare.size());
+  REQUIRE_THROWS_AS(parse_tokens(bare_lexer), InvalidTokenException);
+}
+
+
 Expression run(const std::string & program){
   
   std::istringstream iss(program);
@@ -446,6 +634,29 @@ TEST_CASE( "Test Interpreter parser with empty expression", "[interpreter]" ) {
   REQUIRE(ok == false);
 }
 
+TEST_CASE( "Test Interpreter error offsets", "[interpreter]" ) {
+
+  {
+    std::string program = "(begin\n  (+ 1 1abc))";
+    Interpreter interp;
+    REQUIRE_FALSE(interp.parse(program.data(), program.size()));
+    REQUIRE(interp.hasErrorOffset());
+    REQUIRE(interp.getErrorOffset() == 14);
+  }
+
+  {
+    std::string program = "(begin\n  (+ 1 True))";
+    Interpreter interp;
+    REQUIRE(interp.parse(program.data(), program.size()));
+    REQUIRE_THROWS_AS(interp.eval(), InterpreterSemanticError);
+    REQUIRE(interp.hasErrorOffset());
+    REQUIRE(interp.getErrorOffset() == 9);
+    source::Position position = source::LineIndex(program.data(), program.size()).locate(9);
+    REQUIRE(position.line == 2);
+    REQUIRE(position.column == 3);
+  }
+}
+
 TEST_CASE( "Test Interpreter parser with bad number string", "[interpreter]" ) {
 
   std::string program = "(1abc)";
@@ -703,3 +914,920 @@ TEST_CASE("Test environment bad lookup.") {
   environment::Environment env;
   REQUIRE_THROWS_AS(env.get("abc"), environment::LookupException);
 }
+
+#include <unistd.h>
+
+#include "source.hpp"
+
+TEST_CASE("Test mapped source buffer.") {
+  std::string fname = TEST_FILE_DIR + "/test4.vts";
+  std::ifstream ifs(fname);
+  std::string expected((std::istreambuf_iterator<char>(ifs)),
+		       std::istreambuf_iterator<char>());
+
+  source::Buffer buffer;
+  REQUIRE(buffer.open(fname));
+  REQUIRE(buffer.isMapped());
+  REQUIRE(std::string(buffer.getData(), buffer.getSize()) == expected);
+
+  Interpreter interp;
+  REQUIRE(interp.parse(buffer.getData(), buffer.getSize()));
+  REQUIRE(interp.eval() == Expression(-1.));
+
+  REQUIRE_FALSE(buffer.open("/there/is/no/such/file"));
+  REQUIRE_FALSE(buffer.open(TEST_FILE_DIR));
+}
+
+TEST_CASE("Test source buffer falls back to reads for pipes.") {
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  std::string program = "(+ 1 2)";
+  REQUIRE(write(fds[1], program.data(), program.size()) == (ssize_t) program.size());
+  close(fds[1]);
+
+  source::Buffer buffer;
+  REQUIRE(buffer.read(fds[0]));
+  close(fds[0]);
+  REQUIRE_FALSE(buffer.isMapped());
+  REQUIRE(std::string(buffer.getData(), buffer.getSize()) == program);
+}
+
+#include "generate.hpp"
+
+TEST_CASE("Test generated programs are deterministic and valid.") {
+  generate::Options options;
+  options.forms = 300;
+  options.defines = 100;
+  options.depth = 5;
+  options.if_density = 0.3;
+  options.comment_density = 0.2;
+  for (uint64_t seed = 1; seed <= 20; seed++) {
+    options.seed = seed;
+    std::string text = generate::program(options);
+    REQUIRE(text == generate::program(options));
+    Interpreter interp;
+    REQUIRE(interp.parse(text.data(), text.size()));
+    Expression result;
+    REQUIRE_NOTHROW(result = interp.eval());
+    REQUIRE(result.getType() == NUMBER);
+  }
+
+  options.seed = 99;
+  options.bytes = 20000;
+  std::string text = generate::program(options);
+  REQUIRE(text.size() >= 20000);
+  REQUIRE(text.size() < 21000);
+
+  generate::Random random(5);
+  REQUIRE(random.next() == generate::Random(5).next());
+}
+
+TEST_CASE("Test parsing nesting deeper than the call stack.") {
+  std::string shallow = "(((+ 1 2)))";
+  Expression expected = Expression(std::vector<Expression>{Expression(std::string("+")),
+	Expression(1.0), Expression(2.0)});
+  for (int i = 0; i < 2; i++) {
+    expected = Expression(std::vector<Expression>{expected});
+  }
+  token::Lexer shallow_lexer(shallow.data(), shallow.size());
+  REQUIRE(parse_tokens(shallow_lexer) == expected);
+
+  const size_t depth = 1000000;
+  std::string program = std::string(depth, '(') + "(+ 1 2)" + std::string(depth, ')');
+  token::Lexer lexer(program.data(), program.size());
+  Expression parsed = parse_tokens(lexer);
+  REQUIRE(parsed.getChildCount() == 1);
+  REQUIRE(parsed.getOffset() == 0);
+
+  Interpreter interp;
+  REQUIRE(interp.parse(program.data(), program.size()));
+  REQUIRE_THROWS_AS(interp.eval(), InterpreterSemanticError);
+
+  size_t nesting = 0;
+  token::Lexer nesting_lexer(shallow.data(), shallow.size());
+  parse_tokens(nesting_lexer, &nesting);
+  REQUIRE(nesting == 3);
+
+  std::string unbalanced = std::string(depth, '(') + "1" + std::string(depth - 1, ')');
+  REQUIRE_FALSE(interp.parse(unbalanced.data(), unbalanced.size()));
+
+  std::stringstream stream(std::string(100000, '(') + "1" + std::string(100000, ')'));
+  std::list<token::Token> tokens = token::tokenize(stream);
+  REQUIRE(parse_tokens(tokens).getChildCount() == 1);
+}
+
+/*
+ * Parse with parse_text and with a lexer, and check they agree on the
+ * tree or on where the error is.
+ */
+void require_same_parse(const std::string & text) {
+  bool text_failed = false;
+  bool lexer_failed = false;
+  uint32_t text_offset = 0;
+  uint32_t lexer_offset = 0;
+  Expression text_tree;
+  Expression lexer_tree;
+  try {
+    text_tree = parse_text(text.data(), text.size());
+  } catch (InvalidTokenException & e) {
+    text_failed = true;
+    text_offset = e.getOffset();
+  }
+  try {
+    token::Lexer lexer(text.data(), text.size());
+    lexer_tree = parse_tokens(lexer);
+  } catch (InvalidTokenException & e) {
+    lexer_failed = true;
+    lexer_offset = e.getOffset();
+  }
+  INFO(text);
+  REQUIRE(text_failed == lexer_failed);
+  REQUIRE(text_offset == lexer_offset);
+  REQUIRE(text_tree == lexer_tree);
+  REQUIRE(text_tree.getOffset() == lexer_tree.getOffset());
+}
+
+TEST_CASE("Test parsing straight from text.") {
+  std::vector<std::string> inputs = {
+    "", " ", "(", ")", "()", "(1)", "x", "4", "1abc", "(+ 1 1abc)", "(1) 2", "(1) (2)",
+    "(1)x", "x (1)", "(a\v b)", "(a \vb)", "(; comment\n 1)", "(1 ; open",
+    "(begin (define a 1) (if True a -2.5e3))", "((None False) 3.)", "(1))", "(1 ()"
+  };
+  for (auto & input : inputs) {
+    require_same_parse(input);
+  }
+  require_same_parse(scan_test_input());
+
+  generate::Options options;
+  options.forms = 200;
+  options.comment_density = 0.3;
+  for (uint64_t seed = 1; seed <= 5; seed++) {
+    options.seed = seed;
+    std::string program = generate::program(options);
+    require_same_parse(program);
+    require_same_parse(program.substr(0, program.size() / 2));
+  }
+
+  size_t depth = 0;
+  std::string nested = "(a (b (c)) (d))";
+  parse_text(nested.data(), nested.size(), &depth);
+  REQUIRE(depth == 3);
+
+  std::stringstream stream("(+ 1 2)");
+  std::list<token::Token> tokens = token::tokenize(stream);
+  parse_tokens(tokens);
+  REQUIRE(tokens.size() == 5);
+}
+
+TEST_CASE("Test reading top-level forms from a stream.") {
+  std::stringstream stream("; header\n(define a 1)\n  (+ a\n ; ) not a paren\n 2) x(3)\n\v y )\n(1 2");
+  source::FormReader reader(stream);
+  std::string form;
+  std::vector<std::string> forms;
+  std::vector<uint64_t> offsets;
+  std::vector<size_t> lines;
+  while (reader.next(form)) {
+    forms.push_back(form);
+    offsets.push_back(reader.getOffset());
+    lines.push_back(reader.getPosition().line);
+  }
+  std::vector<std::string> expected_forms = {
+    "(define a 1)", "(+ a\n ; ) not a paren\n 2)", "x", "(3)", "y", ")", "(1 2"
+  };
+  REQUIRE(forms == expected_forms);
+  REQUIRE(offsets.front() == 9);
+  REQUIRE(offsets.at(2) == 50);
+  std::vector<size_t> expected_lines = {2, 3, 5, 5, 6, 6, 7};
+  REQUIRE(lines == expected_lines);
+
+  // A \v that doesn't follow other whitespace starts an atom, like in
+  // the lexer.
+  std::stringstream vertical("(1)\vz");
+  source::FormReader vertical_reader(vertical);
+  REQUIRE(vertical_reader.next(form));
+  REQUIRE(vertical_reader.next(form));
+  REQUIRE(form == "\vz");
+  REQUIRE_FALSE(vertical_reader.next(form));
+
+  // Definitions carry over between forms run on one interpreter.
+  std::stringstream script("(define b 2) (define c (* b 3))\n(+ b c)");
+  source::FormReader script_reader(script);
+  Interpreter interp;
+  Expression result;
+  while (script_reader.next(form)) {
+    REQUIRE(interp.parse(form.data(), form.size()));
+    result = interp.eval();
+  }
+  REQUIRE(result == Expression(8.));
+}
+
+#include "compiled.hpp"
+
+TEST_CASE("Test compiling programs to the .vtc format.") {
+  generate::Options options;
+  options.forms = 300;
+  for (uint64_t seed = 1; seed <= 5; seed++) {
+    options.seed = seed;
+    std::string program = generate::program(options);
+    std::string output;
+    REQUIRE(compiled::compile(program.data(), program.size(), output));
+    REQUIRE(compiled::is_compiled(output.data(), output.size()));
+    REQUIRE(compiled::matches(output.data(), output.size(), program.data(), program.size()));
+
+    flat::Tree loaded;
+    size_t depth = 0;
+    REQUIRE(compiled::load(output.data(), output.size(), loaded, depth));
+    size_t parsed_depth = 0;
+    Expression parsed = parse_text(program.data(), program.size(), &parsed_depth);
+    REQUIRE(flat::expand(loaded, 0) == parsed);
+    REQUIRE(depth == parsed_depth);
+
+    Interpreter from_text;
+    Interpreter from_compiled;
+    REQUIRE(from_text.parse(program.data(), program.size()));
+    REQUIRE(from_compiled.load(output.data(), output.size()));
+    REQUIRE(from_text.eval() == from_compiled.eval());
+  }
+
+  std::string program = "(begin (define a 1)\n (+ a b))";
+  std::string output;
+  REQUIRE(compiled::compile(program.data(), program.size(), output));
+  Interpreter interp;
+  REQUIRE(interp.load(output.data(), output.size()));
+  REQUIRE_THROWS_AS(interp.eval(), InterpreterSemanticError);
+  std::string changed = program + " ";
+  REQUIRE_FALSE(compiled::matches(output.data(), output.size(), changed.data(), changed.size()));
+
+  // Damaged, truncated and stale files are all turned away.
+  std::string damaged = output;
+  damaged[damaged.size() - 1] ^= 1;
+  REQUIRE_FALSE(interp.load(damaged.data(), damaged.size()));
+  damaged = output;
+  damaged[sizeof(compiled::Header) + 3] ^= 1;
+  REQUIRE_FALSE(interp.load(damaged.data(), damaged.size()));
+  REQUIRE_FALSE(interp.load(output.data(), output.size() - 1));
+  std::string stale = output;
+  stale[4] = 0;
+  REQUIRE_FALSE(interp.load(stale.data(), stale.size()));
+  REQUIRE_FALSE(interp.load(program.data(), program.size()));
+
+  // Only programs Interpreter::parse would take get compiled.
+  std::string bad = "(+ 1 1abc)";
+  REQUIRE_FALSE(compiled::compile(bad.data(), bad.size(), output));
+  std::string atom = "4";
+  REQUIRE_FALSE(compiled::compile(atom.data(), atom.size(), output));
+
+  // Loading doesn't recurse either.
+  std::string nested = std::string(1000000, '(') + "1" + std::string(1000000, ')');
+  std::string nested_output;
+  REQUIRE(compiled::compile(nested.data(), nested.size(), nested_output));
+  flat::Tree nested_program;
+  size_t nested_depth = 0;
+  REQUIRE(compiled::load(nested_output.data(), nested_output.size(), nested_program, nested_depth));
+  REQUIRE(nested_depth == 1000000);
+
+  // A file that claims to be shallower than it is gets turned away,
+  // since eval's depth guard goes by it.
+  std::string shallow = nested_output;
+  uint32_t claimed = 1;
+  std::memcpy(&shallow[offsetof(compiled::Header, depth)], &claimed, sizeof(claimed));
+  REQUIRE_FALSE(compiled::load(shallow.data(), shallow.size(), nested_program, nested_depth));
+
+  // Every kind of atom round trips.
+  std::string atoms = "(begin (define a None) (define b False) (if (not b) (+ 1 (* 2 3)) a))";
+  std::string atoms_output;
+  REQUIRE(compiled::compile(atoms.data(), atoms.size(), atoms_output));
+  flat::Tree atoms_program;
+  size_t atoms_depth = 0;
+  REQUIRE(compiled::load(atoms_output.data(), atoms_output.size(), atoms_program, atoms_depth));
+  REQUIRE(flat::expand(atoms_program, 0) == parse_text(atoms.data(), atoms.size()));
+  REQUIRE(atoms_depth == 4);
+  Interpreter atoms_interp;
+  REQUIRE(atoms_interp.load(atoms_output.data(), atoms_output.size()));
+  REQUIRE(atoms_interp.eval() == Expression(7.));
+}
+
+#include "cache.hpp"
+
+TEST_CASE("Test the parse cache.") {
+  cache::ParseCache cache(2);
+  std::string a = "(+ 1 2)";
+  std::string b = "(* 3 4)";
+  std::string c = "(- 5 6)";
+  Expression program;
+  size_t depth = 0;
+  REQUIRE_FALSE(cache.lookup(a.data(), a.size(), program, depth));
+  cache.insert(a.data(), a.size(), parse_text(a.data(), a.size()), 1);
+  cache.insert(b.data(), b.size(), parse_text(b.data(), b.size()), 1);
+  REQUIRE(cache.lookup(a.data(), a.size(), program, depth));
+  REQUIRE(program == parse_text(a.data(), a.size()));
+  REQUIRE(depth == 1);
+
+  // a was used last, so b is the one to go.
+  cache.insert(c.data(), c.size(), parse_text(c.data(), c.size()), 1);
+  REQUIRE(cache.getSize() == 2);
+  REQUIRE_FALSE(cache.lookup(b.data(), b.size(), program, depth));
+  REQUIRE(cache.lookup(a.data(), a.size(), program, depth));
+  REQUIRE(cache.lookup(c.data(), c.size(), program, depth));
+  REQUIRE(cache.getHits() == 3);
+  REQUIRE(cache.getMisses() == 2);
+
+  cache.setCapacity(1);
+  REQUIRE(cache.getSize() == 1);
+  cache.setCapacity(0);
+  cache.insert(a.data(), a.size(), program, 1);
+  REQUIRE(cache.getSize() == 0);
+  cache.clear();
+  REQUIRE(cache.getHits() == 0);
+
+  // Through an interpreter. Only good parses are kept, and the
+  // environment isn't.
+  cache.setCapacity(8);
+  std::string define = "(define x 2)";
+  std::string bad = "(+ 1 1abc)";
+  Interpreter first;
+  first.setParseCache(&cache);
+  REQUIRE(first.parse(define.data(), define.size()));
+  REQUIRE(first.eval() == Expression(2.));
+  REQUIRE_FALSE(first.parse(bad.data(), bad.size()));
+  REQUIRE_FALSE(first.parse(bad.data(), bad.size()));
+  REQUIRE(first.getErrorOffset() == 5);
+  REQUIRE(cache.getSize() == 1);
+  Interpreter second;
+  second.setParseCache(&cache);
+  REQUIRE(second.parse(define.data(), define.size()));
+  REQUIRE(second.eval() == Expression(2.));
+  REQUIRE(cache.getHits() == 1);
+  REQUIRE(cache.getMisses() == 3);
+
+  // A hit doesn't report the lists of the parse before it.
+  std::string sum = "(+ (* 2 3) (* 2 3))";
+  Interpreter consing;
+  consing.setParseCache(&cache);
+  consing.setHashConsing(true);
+  REQUIRE(consing.parse(sum.data(), sum.size()));
+  REQUIRE(consing.getParseStats().lists == 3);
+  REQUIRE(consing.parse(sum.data(), sum.size()));
+  REQUIRE(consing.getParseStats().lists == 0);
+  REQUIRE(consing.getParseStats().unique_lists == 0);
+
+  // Lazy lists are parsed on the way in, so cached trees never change.
+  std::string branches = "(if (< 1 2) (+ 1 2) (* 3 (- 4 1)))";
+  std::shared_ptr<const std::string> owned = std::make_shared<const std::string>(branches);
+  Expression lazy = parse_lazy(owned, 1);
+  REQUIRE(lazy.getChild(3).isLazy());
+  cache.insert(branches.data(), branches.size(), lazy, 3);
+  REQUIRE_FALSE(lazy.getChild(2).isLazy());
+  REQUIRE_FALSE(lazy.getChild(3).isLazy());
+  REQUIRE_FALSE(lazy.getChild(3).getChild(2).isLazy());
+  REQUIRE(cache.lookup(branches.data(), branches.size(), program, depth));
+  REQUIRE(program == parse_text(branches.data(), branches.size()));
+}
+
+TEST_CASE("Test hash consing identical subtrees.") {
+  std::string program = "(begin (define rate 2) (+ (* rate 1.5) (* rate 1.5) (* rate 1.5) (- 0.0) (- -0.0)))";
+  HashConser conser;
+  Expression shared = parse_text(program.data(), program.size(), nullptr, &conser);
+  REQUIRE(shared == parse_text(program.data(), program.size()));
+  ParseStats stats = conser.getStats();
+  REQUIRE(stats.lists == 8);
+  // The three (* rate 1.5) share; 0.0 and -0.0 don't.
+  REQUIRE(stats.unique_lists == 6);
+  REQUIRE(stats.getDedupeRatio() == Approx(0.25));
+
+  // Every occurrence keeps its own offset at the top.
+  std::vector<Expression> sum = shared.getChildren().at(2).getChildren();
+  REQUIRE(sum.at(1).getOffset() == 26);
+  REQUIRE(sum.at(2).getOffset() == 39);
+
+  Interpreter interp;
+  interp.setHashConsing(true);
+  REQUIRE(interp.parse(program.data(), program.size()));
+  REQUIRE(interp.getParseStats().lists == 8);
+  REQUIRE(interp.eval() == Expression(9.));
+
+  token::Lexer lexer(program.data(), program.size());
+  HashConser lexer_conser;
+  REQUIRE(parse_tokens(lexer, nullptr, &lexer_conser) == shared);
+  REQUIRE(lexer_conser.getStats().unique_lists == 6);
+}
+
+/*
+ * Parse with parse_lazy and with parse_text, and check they agree on
+ * the tree and the depth, or on where the error is.
+ */
+void require_same_lazy_parse(const std::string & text, size_t threshold) {
+  std::shared_ptr<const std::string> source = std::make_shared<const std::string>(text);
+  bool lazy_failed = false;
+  bool text_failed = false;
+  uint32_t lazy_offset = 0;
+  uint32_t text_offset = 0;
+  size_t lazy_depth = 0;
+  size_t text_depth = 0;
+  Expression lazy_tree;
+  Expression text_tree;
+  try {
+    lazy_tree = parse_lazy(source, threshold, &lazy_depth);
+  } catch (InvalidTokenException & e) {
+    lazy_failed = true;
+    lazy_offset = e.getOffset();
+  }
+  try {
+    text_tree = parse_text(text.data(), text.size(), &text_depth);
+  } catch (InvalidTokenException & e) {
+    text_failed = true;
+    text_offset = e.getOffset();
+  }
+  INFO(text);
+  REQUIRE(lazy_failed == text_failed);
+  REQUIRE(lazy_offset == text_offset);
+  if (!text_failed) {
+    REQUIRE(lazy_depth == text_depth);
+    REQUIRE(lazy_tree == text_tree);
+  }
+}
+
+TEST_CASE("Test lazy parsing of if branches.") {
+  std::vector<std::string> inputs = {
+    "(if True (+ 1 2) (+ 3 4))", "(begin (define a 1) (+ a (* 2 3)))",
+    "(if True (+ 1 2) (+ 3 1abc))", "(if True (+ 1 2) (+ 3 ()))", "(begin (+ 1 (2)",
+    "(if True (+ 1 2) (+ 3 4)) (1)", "(if (< 1 2) ((((1)))) ; (\n (2))", "(if a b (c (d) e) f)"
+  };
+  for (auto & input : inputs) {
+    require_same_lazy_parse(input, 1);
+    require_same_lazy_parse(input, 10);
+  }
+  generate::Options options;
+  options.forms = 200;
+  options.if_density = 0.5;
+  for (uint64_t seed = 1; seed <= 5; seed++) {
+    options.seed = seed;
+    std::string program = generate::program(options);
+    require_same_lazy_parse(program, 16);
+    require_same_lazy_parse(program.substr(0, program.size() / 3), 16);
+
+    Interpreter lazy;
+    lazy.setLazyParsing(16);
+    Interpreter eager;
+    REQUIRE(lazy.parse(program.data(), program.size()));
+    REQUIRE(eager.parse(program.data(), program.size()));
+    Expression result = eager.eval();
+    REQUIRE(lazy.eval() == result);
+
+    // Asking for the flat layout too leaves the lazy tree as it is.
+    Interpreter lazy_flat;
+    lazy_flat.setLazyParsing(16);
+    lazy_flat.setFlatLayout(true);
+    REQUIRE(lazy_flat.parse(program.data(), program.size()));
+    REQUIRE(lazy_flat.eval() == result);
+  }
+
+  // The interpreter keeps its own copy of the text for lazy lists, so
+  // the caller's buffer can change or go once parse returns. That holds
+  // for inputs big enough to be lexed on several threads as well.
+  token::ParallelOptions parallel;
+  parallel.threshold = 0;
+  parallel.threads = 2;
+  for (int threads = 0; threads < 2; threads++) {
+    std::string buffer = "(if (< 1 2) (+ 1 2) (* 3 4))";
+    Interpreter owning;
+    owning.setLazyParsing(1);
+    if (threads == 1) {
+      owning.setParallelOptions(parallel);
+    }
+    REQUIRE(owning.parse(buffer.data(), buffer.size()));
+    buffer.replace(12, 7, "(+ 5 5)");
+    REQUIRE(owning.eval() == Expression(3.));
+  }
+
+  // Only the branch that's taken gets parsed.
+  std::shared_ptr<const std::string> source =
+    std::make_shared<const std::string>("(if (< 1 2) (+ 1 2) (* 3 4))");
+  Expression tree = parse_lazy(source, 1);
+  REQUIRE_FALSE(tree.isLazy());
+  REQUIRE(tree.getChildren().at(2).isLazy());
+  REQUIRE(tree.getChildren().at(3).isLazy());
+  REQUIRE_FALSE(tree.getChildren().at(1).isLazy());
+  environment::Environment env;
+  REQUIRE(eval_iter(tree, env) == Expression(3.));
+  REQUIRE_FALSE(tree.getChildren().at(2).isLazy());
+  REQUIRE(tree.getChildren().at(3).isLazy());
+  REQUIRE(tree.getChildren().at(3).getOffset() == 20);
+
+  // A branch of exactly threshold bytes is lazy, one byte short isn't.
+  std::string exact = "(if True (+ 1 2) (* 3 4))";
+  std::vector<Diagnostic> exact_found;
+  REQUIRE(parse_lazy(exact.data(), exact.size(), 7, exact_found).getChild(2).isLazy());
+  REQUIRE_FALSE(parse_lazy(exact.data(), exact.size(), 8, exact_found).getChild(2).isLazy());
+  REQUIRE(exact_found.empty());
+
+  // Branches inside a lazy branch are lazy too once it's parsed, and
+  // begin forms never are. The text can be borrowed instead of copied.
+  std::string nested = "(begin (+ 1 2) (if True (if False (+ 1 2) (* 3 4)) (+ 5 6)))";
+  std::vector<Diagnostic> found;
+  Expression borrowed = parse_lazy(nested.data(), nested.size(), 1, found);
+  REQUIRE(found.empty());
+  REQUIRE_FALSE(borrowed.getChild(1).isLazy());
+  const Expression & branch = borrowed.getChild(2).getChild(2);
+  REQUIRE(branch.isLazy());
+  REQUIRE(borrowed.getChild(2).getChild(3).isLazy());
+  REQUIRE(branch.getChild(2).isLazy());
+  REQUIRE_FALSE(branch.isLazy());
+  REQUIRE(branch.getChild(3).isLazy());
+  REQUIRE(branch.getChild(3).getOffset() == 42);
+  environment::Environment nested_env;
+  REQUIRE(eval_iter(borrowed, nested_env) == Expression(12.));
+  REQUIRE(borrowed == parse_text(nested.data(), nested.size()));
+}
+
+TEST_CASE("Test recovering from syntax errors.") {
+  std::string program = "(begin (+ 1 1abc) ()\n (define 2x 3) (* 2 3)) ) (4)";
+  std::vector<Diagnostic> diagnostics;
+  parse_text(program.data(), program.size(), diagnostics);
+  std::vector<Diagnostic::Kind> kinds;
+  std::vector<uint32_t> offsets;
+  for (auto & diagnostic : diagnostics) {
+    kinds.push_back(diagnostic.kind);
+    offsets.push_back(diagnostic.offset);
+    REQUIRE_FALSE(diagnostic.message.empty());
+  }
+  std::vector<Diagnostic::Kind> expected_kinds = {
+    Diagnostic::BAD_ATOM, Diagnostic::EMPTY_LIST, Diagnostic::BAD_ATOM,
+    Diagnostic::STRAY_CLOSE, Diagnostic::EXTRA_FORM
+  };
+  std::vector<uint32_t> expected_offsets = {12, 19, 30, 45, 47};
+  REQUIRE(kinds == expected_kinds);
+  REQUIRE(offsets == expected_offsets);
+  REQUIRE(diagnostics.front().message == "invalid atom '1abc'");
+
+  // The first diagnostic is always the error the throwing parse stops at.
+  std::vector<std::string> inputs = {
+    "", "x", "4", ")", "(", "()", "(1) 2", "x (1)", "(1 (2)", "(()", "(1))", "((1) ; x\n",
+    "(if True (+ 1 2) (+ 3 1abc))", ") x", "1abc 2"
+  };
+  for (auto & input : inputs) {
+    INFO(input);
+    std::vector<Diagnostic> found;
+    size_t found_depth = 0;
+    Expression recovered = parse_text(input.data(), input.size(), found, &found_depth);
+    try {
+      size_t thrown_depth = 0;
+      Expression thrown = parse_text(input.data(), input.size(), &thrown_depth);
+      REQUIRE(found.empty());
+      REQUIRE(recovered == thrown);
+      REQUIRE(found_depth == thrown_depth);
+    } catch (InvalidTokenException & e) {
+      REQUIRE_FALSE(found.empty());
+      REQUIRE(found.front().offset == e.getOffset());
+    }
+    std::shared_ptr<const std::string> source = std::make_shared<const std::string>(input);
+    std::vector<Diagnostic> lazy_found;
+    parse_lazy(source, 1, lazy_found);
+    REQUIRE(lazy_found.size() == found.size());
+    // Parsed from tokens, as the parallel path does, it's the same.
+    token::Lexer lexer(input.data(), input.size());
+    std::vector<Diagnostic> token_found;
+    size_t token_depth = 0;
+    Expression from_tokens = parse_tokens(lexer, token_found, &token_depth);
+    REQUIRE(token_found.size() == found.size());
+    for (size_t i = 0; i < found.size(); i++) {
+      REQUIRE(token_found[i].kind == found[i].kind);
+      REQUIRE(token_found[i].offset == found[i].offset);
+      REQUIRE(token_found[i].message == found[i].message);
+    }
+    if (found.empty()) {
+      REQUIRE(from_tokens == recovered);
+      REQUIRE(token_depth == found_depth);
+    }
+  }
+
+  Interpreter interp;
+  REQUIRE_FALSE(interp.parse(program.data(), program.size()));
+  REQUIRE(interp.getDiagnostics().size() == 5);
+  REQUIRE(interp.getErrorOffset() == 12);
+  std::string atom = "4";
+  REQUIRE_FALSE(interp.parse(atom.data(), atom.size()));
+  REQUIRE(interp.getDiagnostics().front().kind == Diagnostic::NOT_A_LIST);
+  std::string good = "(+ 1 2)";
+  REQUIRE(interp.parse(good.data(), good.size()));
+  REQUIRE(interp.getDiagnostics().empty());
+
+  token::ParallelOptions parallel;
+  parallel.threshold = 0;
+  parallel.threads = 4;
+  interp.setParallelOptions(parallel);
+  REQUIRE_FALSE(interp.parse(program.data(), program.size()));
+  REQUIRE(interp.getDiagnostics().size() == 5);
+  REQUIRE(interp.getErrorOffset() == 12);
+  REQUIRE(interp.getDiagnostics().back().kind == Diagnostic::EXTRA_FORM);
+}
+
+#include "reader.hpp"
+
+/*
+ * Writes down every reader event, so two reads can be compared.
+ */
+class RecordingHandler : public reader::Handler {
+public:
+  void on_open(uint64_t offset) {
+    log << "(@" << offset << " ";
+  }
+  void on_atom(token::Type kind, const char * text, size_t length, uint64_t offset) {
+    log << kind << ":" << std::string(text, length) << "@" << offset << " ";
+  }
+  void on_close(uint64_t offset) {
+    log << ")@" << offset << " ";
+  }
+  void on_numbers(const double * values, size_t count, uint64_t offset) {
+    log << "[";
+    for (size_t i = 0; i < count; i++) {
+      log << values[i] << ",";
+    }
+    log << "]@" << offset << " ";
+  }
+  std::ostringstream log;
+};
+
+TEST_CASE("Test the event reader.") {
+  std::string data = "; numbers\n(1 2 -3.5 x (4e2) True\n\v\f5 6) () None ;\n foo";
+
+  RecordingHandler whole;
+  reader::Reader reader(whole);
+  REQUIRE(reader.read(data.data(), data.size()));
+  REQUIRE(whole.log.str() ==
+	  "(@10 3:1@11 3:2@13 3:-3.5@15 6:x@20 (@22 3:4e2@23 )@26 4:True@28 "
+	  "3:5@35 3:6@37 )@38 (@40 )@41 5:None@43 6:foo@51 ");
+  REQUIRE(reader.getDepth() == 0);
+  REQUIRE(reader.getOffset() == data.size());
+
+  // Any way of cutting the input up gives the same events.
+  for (size_t piece = 1; piece < data.size(); piece++) {
+    INFO(piece);
+    RecordingHandler pieces;
+    reader::Reader chunked(pieces);
+    for (size_t i = 0; i < data.size(); i += piece) {
+      REQUIRE(chunked.feed(data.data() + i, std::min(piece, data.size() - i)));
+    }
+    REQUIRE(chunked.finish());
+    REQUIRE(pieces.log.str() == whole.log.str());
+
+    RecordingHandler streamed;
+    reader::Options options;
+    options.chunk_size = piece;
+    reader::Reader from_stream(streamed, options);
+    std::istringstream stream(data);
+    REQUIRE(from_stream.read(stream));
+    REQUIRE(streamed.log.str() == whole.log.str());
+  }
+
+  reader::Options packed;
+  packed.pack_numbers = true;
+  packed.batch_size = 2;
+  RecordingHandler numbers;
+  reader::Reader packing(numbers, packed);
+  REQUIRE(packing.read(data.data(), data.size()));
+  REQUIRE(numbers.log.str() ==
+	  "(@10 [1,2,]@11 [-3.5,]@15 6:x@20 (@22 [400,]@23 )@26 4:True@28 "
+	  "[5,6,]@35 )@38 (@40 )@41 5:None@43 6:foo@51 ");
+
+  // Numbers outside any list are packed as well, up to the next paren.
+  RecordingHandler top_level;
+  reader::Reader top_packing(top_level, packed);
+  std::string loose = "1 2 3 (4) 5";
+  REQUIRE(top_packing.read(loose.data(), loose.size()));
+  REQUIRE(top_level.log.str() == "[1,2,]@0 [3,]@4 (@6 [4,]@7 )@8 [5,]@10 ");
+
+  std::vector<std::pair<std::string, uint64_t>> errors = {
+    {"(1 2))", 5}, {"(1 (2)", 6}, {"(1 1abc)", 3}, {")", 0}, {"x 2y", 2}
+  };
+  for (auto & error : errors) {
+    INFO(error.first);
+    RecordingHandler ignored;
+    reader::Reader failing(ignored);
+    REQUIRE_FALSE(failing.read(error.first.data(), error.first.size()));
+    REQUIRE(failing.getErrorOffset() == error.second);
+    REQUIRE_FALSE(failing.getError().empty());
+    REQUIRE_FALSE(failing.feed("1", 1));
+  }
+}
+
+#include "flat.hpp"
+
+/*
+ * Run a program with and without the flat layout and check both ways
+ * give the same value, or fail with the same error at the same place.
+ */
+static void require_same_eval(const std::string & program) {
+  INFO(program);
+  std::string outcomes[2];
+  for (int i = 0; i < 2; i++) {
+    Interpreter interp;
+    interp.setFlatLayout(i == 1);
+    REQUIRE(interp.parse(program.data(), program.size()));
+    std::ostringstream outcome;
+    try {
+      outcome << interp.eval();
+      // A second run sees the definitions of the first.
+      outcome << " " << interp.eval();
+    } catch (InterpreterSemanticError & e) {
+      outcome << e.what();
+    }
+    outcome << " " << interp.hasErrorOffset();
+    if (interp.hasErrorOffset()) {
+      outcome << "@" << interp.getErrorOffset();
+    }
+    outcomes[i] = outcome.str();
+  }
+  REQUIRE(outcomes[0] == outcomes[1]);
+}
+
+TEST_CASE("Test the flat layout.") {
+  std::string text = "(begin (define a 2) (+ a (* 2 3) 2) (if (< a 3) True b))";
+  Expression program = parse_text(text.data(), text.size());
+  flat::Tree tree = flat::flatten(program);
+  REQUIRE(tree.size() == 22);
+  REQUIRE(tree.types[0] == LIST);
+  REQUIRE(tree.values[0] == 1);
+  REQUIRE(tree.counts[0] == 4);
+  // The children of every list sit next to each other.
+  for (uint32_t i = 0; i < tree.size(); i++) {
+    if (tree.types[i] == LIST) {
+      REQUIRE(tree.values[i] > i);
+      REQUIRE(tree.values[i] + tree.counts[i] <= tree.size());
+    }
+  }
+  // 2 and 3 are pooled once each, and so is a.
+  REQUIRE(tree.numbers.size() == 2);
+  REQUIRE(tree.symbols.size() == 8);
+  REQUIRE(tree.forms[tree.values[tree.values[0]]] == builtin::BEGIN);
+  REQUIRE(flat::expand(tree, 0) == program);
+  REQUIRE(flat::expand(tree, 3).getOffset() == 20);
+  REQUIRE(builtin::lookup("<=", 2) == builtin::LESS_EQUAL);
+  REQUIRE(builtin::lookup("x", 1) == builtin::NO_OPCODE);
+
+  std::vector<std::string> programs = {
+    text, "(1)", "(+)", "(begin)", "(not False)", "(not 1)", "(not True False)",
+    "(and True False True)", "(or False False)", "(and True)", "(or True 1 x)",
+    "(< 1 2)", "(<= 2 2)", "(> 1 2)", "(>= 1 2)", "(= 1 1)", "(< 1)", "(= 1 True)",
+    "(+ 1 2 3)", "(* 2 3 4)", "(- 5)", "(- 5 2)", "(- 1 2 3)", "(/ 1 4)", "(/ 1 0)",
+    "(+ True x)", "(define pi 3)", "(define + 3)", "(define 1 2)", "(define x)",
+    "(define x 5)", "(if True 1 2)", "(if 1 2 3)", "(if True 1)", "(1 2)", "(foo 1)",
+    "(begin (define b 1) (+ b pi))", "(begin ((2)) 1)", "(+ 1 (-))", "(begin None)",
+    "(begin (define x 1) (define y (+ x 1)) (if (and (< x y) (not (= x y))) (* y 10) x))"
+  };
+  for (auto & program : programs) {
+    require_same_eval(program);
+  }
+
+  generate::Options options;
+  options.forms = 200;
+  options.defines = 50;
+  options.depth = 5;
+  options.if_density = 0.3;
+  for (uint64_t seed = 1; seed <= 10; seed++) {
+    options.seed = seed;
+    require_same_eval(generate::program(options));
+  }
+}
+
+TEST_CASE("Test the reference accessors and moves.") {
+  std::string text = "(define answer (+ 40 2))";
+  Expression program = parse_text(text.data(), text.size());
+  Expression copy = program;
+  // Copies share their children, and looking at them copies nothing.
+  REQUIRE(&copy.getChildren() == &program.getChildren());
+  REQUIRE(&program.getChild(2) == &program.getChildren()[2]);
+  REQUIRE(&program.getChild(1).getSymbol() == &copy.getChild(1).getSymbol());
+  REQUIRE(program.getChild(1).getSymbol() == "answer");
+  REQUIRE(program.getChild(2).getChild(2).getNumber() == 2);
+  REQUIRE_THROWS_AS(program.getChild(3), std::out_of_range);
+
+  // Atoms have no children and only symbols have a name.
+  REQUIRE(Expression(1.0).getChildren().empty());
+  REQUIRE(Expression(1.0).getSymbol().empty());
+  REQUIRE_THROWS_AS(Expression(true).getChild(0), std::out_of_range);
+
+  Expression moved = std::move(copy);
+  REQUIRE(moved == program);
+  REQUIRE(&moved.getChildren() == &program.getChildren());
+  copy = std::move(moved);
+  REQUIRE(copy == program);
+  copy = copy;
+  REQUIRE(copy == program);
+  std::vector<Expression> children = program.getChildren();
+  REQUIRE(Expression(std::move(children)) == program);
+}
+
+TEST_CASE("Test evaluating by reference.") {
+  // As deep as eval goes.
+  std::string program;
+  for (size_t i = 1; i < MAX_EVAL_DEPTH; i++) {
+    program += "(+ 1 ";
+  }
+  program += "(- 1)" + std::string(MAX_EVAL_DEPTH - 1, ')');
+  Interpreter interp;
+  REQUIRE(interp.parse(program.data(), program.size()));
+  REQUIRE(interp.eval() == Expression(double(MAX_EVAL_DEPTH - 2)));
+
+  // The tree isn't changed by evaluating it.
+  std::string text = "(begin (define x 2) (if (< x 3) (* x 4) x))";
+  Expression tree = parse_text(text.data(), text.size());
+  Expression copy = tree;
+  environment::Environment env;
+  REQUIRE(eval_iter(tree, env) == Expression(8.));
+  REQUIRE(tree == copy);
+  REQUIRE(&tree.getChildren() == &copy.getChildren());
+  REQUIRE(env.get("x") == Expression(2.));
+
+  // Arguments are all evaluated before their types are checked.
+  environment::Environment fresh;
+  REQUIRE_THROWS_AS(eval_iter(parse_text("(+ True y)", 10), fresh), environment::LookupException);
+  REQUIRE_THROWS_AS(eval_iter(parse_text("(and 1 y)", 9), fresh), environment::LookupException);
+  REQUIRE_THROWS_AS(eval_iter(parse_text("(+ True 1)", 10), fresh), BadArgumentTypeException);
+}
+
+TEST_CASE("Test symbol ids and the environment keyed by them.") {
+  const symbol::Symbol * a = symbol::intern("symbol_id_test");
+  REQUIRE(symbol::intern(std::string("symbol_id_test"))->id == a->id);
+  REQUIRE(symbol::intern("symbol_id_other")->id != a->id);
+  REQUIRE(symbol::name(a->id) == "symbol_id_test");
+  REQUIRE(Expression(std::string("symbol_id_test")).getSymbolId() == a->id);
+  REQUIRE(Expression(1.).getSymbolId() == symbol::NO_SYMBOL);
+
+  environment::Environment env;
+  env.set(a->id, Expression(3.));
+  REQUIRE(env.get("symbol_id_test") == Expression(3.));
+  REQUIRE_THROWS_AS(env.set("symbol_id_test", Expression(4.)), environment::SetException);
+  env.set("symbol_id_late", Expression(true));
+  REQUIRE(env.get(symbol::intern("symbol_id_late")->id) == Expression(true));
+  try {
+    env.get(symbol::intern("symbol_id_other")->id);
+    FAIL("expected a LookupException");
+  } catch (environment::LookupException & e) {
+    REQUIRE(e.getSymbol() == "symbol_id_other");
+  }
+  env.reset();
+  REQUIRE_THROWS_AS(env.get(a->id), environment::LookupException);
+
+  // Looking up a name that was never seen doesn't intern it.
+  size_t interned = symbol::count();
+  try {
+    env.get("symbol_id_never_defined");
+    FAIL("expected a LookupException");
+  } catch (environment::LookupException & e) {
+    REQUIRE(e.getSymbol() == "symbol_id_never_defined");
+  }
+  REQUIRE(symbol::count() == interned);
+  REQUIRE(symbol::lookup("symbol_id_never_defined") == nullptr);
+  REQUIRE(symbol::lookup("symbol_id_test") == a);
+
+  // Both evaluators find variables by id.
+  std::string program = "(begin (define symbol_id_x 2) (define y (+ symbol_id_x 1)) (* y y))";
+  Interpreter tree;
+  REQUIRE(tree.parse(program.data(), program.size()));
+  REQUIRE(tree.eval() == Expression(9.));
+  Interpreter flat_interp;
+  flat_interp.setFlatLayout(true);
+  REQUIRE(flat_interp.parse(program.data(), program.size()));
+  REQUIRE(flat_interp.eval() == Expression(9.));
+}
+
+#include "builtin.hpp"
+
+TEST_CASE("Test the builtin opcode table.") {
+  for (size_t i = 0; i < builtin::OPCODE_COUNT; i++) {
+    REQUIRE(builtin::builtins[i].opcode == i);
+  }
+  REQUIRE(builtin::lookup("define", 6) == builtin::DEFINE);
+  REQUIRE(builtin::lookup("<=", 2) == builtin::LESS_EQUAL);
+  REQUIRE(builtin::lookup("<", 1) == builtin::LESS);
+  REQUIRE(builtin::lookup("defin", 5) == builtin::NO_OPCODE);
+  REQUIRE(builtin::accepts(builtin::DIFFERENCE, 1));
+  REQUIRE(builtin::accepts(builtin::DIFFERENCE, 2));
+  REQUIRE_FALSE(builtin::accepts(builtin::DIFFERENCE, 3));
+  REQUIRE(builtin::accepts(builtin::SUM, 200));
+  REQUIRE_FALSE(builtin::accepts(builtin::SUM, 1));
+
+  // Heads are resolved when they're parsed.
+  REQUIRE(Expression(std::string("if")).getOpcode() == builtin::IF);
+  REQUIRE(Expression(std::string("x")).getOpcode() == builtin::NO_OPCODE);
+  REQUIRE(Expression(2.).getOpcode() == builtin::NO_OPCODE);
+  Expression program = parse_text("(+ 1 2)", 7);
+  REQUIRE(program.getChild(0).getOpcode() == builtin::SUM);
+
+  // Both evaluators check argument counts from the table.
+  std::vector<std::string> bad_counts = {
+    "(not True False)", "(and True)", "(- 1 2 3)", "(/ 1)", "(define x)", "(< 1)", "(if True 1)"
+  };
+  for (auto & text : bad_counts) {
+    environment::Environment env;
+    REQUIRE_THROWS_AS(eval_iter(parse_text(text.data(), text.size()), env), BadArgumentCountException);
+    flat::Tree tree = flat::flatten(parse_text(text.data(), text.size()));
+    REQUIRE_THROWS_AS(flat::eval(tree, env), BadArgumentCountException);
+  }
+  environment::Environment env;
+  REQUIRE_THROWS_AS(eval_iter(parse_text("(x 1 2)", 7), env), InvalidExpressionException);
+  REQUIRE(eval_iter(parse_text("(- 3)", 5), env) == Expression(-3.));
+  flat::Tree tree = flat::flatten(parse_text("(- 3 1)", 7));
+  REQUIRE(flat::eval(tree, env) == Expression(2.));
+}
@@ -0,0 +1,126 @@
+#include "catch.hpp"
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cfloat>
+#include <cmath>
+
+#include "number.hpp"
+
+#define NUMBER "[Number]"
+
+static double parse(const std::string & text) {
+  double value = 12345;
+  REQUIRE(number::parse(text.data(), text.size(), value));
+  return value;
+}
+
+static uint64_t bits(double value) {
+  uint64_t result;
+  std::memcpy(&result, &value, sizeof(result));
+  return result;
+}
+
+/*
+ * A small deterministic generator, so the random cases are the same
+ * on every run and every machine.
+ */
+static uint64_t next_random(uint64_t & state) {
+  state += 0x9E3779B97F4A7C15ull;
+  uint64_t z = state;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+TEST_CASE("Number grammar.", NUMBER) {
+  std::vector<std::string> good = {
+    "3", "314", "3.14", "314.", "-1", "+1", "-.5", "1e5", "1e-5",
+    "1e+5", "0.000", "6.02e23", "00012"
+  };
+  for (auto & text : good) {
+    REQUIRE(number::match(text.data(), text.size()));
+  }
+  std::vector<std::string> bad = {
+    "", "+", "-", ".3", "-.", "1e", "1e+", "e5", "-e", "1ee5", "1e5e5",
+    "1.2.3", "1e5.5", "1-2", "abc", "1abc", "1E5", "++1"
+  };
+  for (auto & text : bad) {
+    REQUIRE_FALSE(number::match(text.data(), text.size()));
+    double value;
+    REQUIRE_FALSE(number::parse(text.data(), text.size(), value));
+  }
+}
+
+TEST_CASE("Number parsing of simple literals.", NUMBER) {
+  REQUIRE(parse("0") == 0.0);
+  REQUIRE(std::signbit(parse("-0")));
+  REQUIRE(parse("1") == 1.0);
+  REQUIRE(parse("-1.0") == -1.0);
+  REQUIRE(parse("314.") == 314.0);
+  REQUIRE(parse("3.14") == 3.14);
+  REQUIRE(parse("-.5") == -0.5);
+  REQUIRE(parse("1e5") == 1e5);
+  REQUIRE(parse("1e-5") == 1e-5);
+  REQUIRE(parse("6.02e23") == 6.02e23);
+  REQUIRE(parse("0.1") == 0.1);
+  REQUIRE(parse("18.562") == 18.562);
+}
+
+TEST_CASE("Number parsing of hard cases.", NUMBER) {
+  // Halfway between 2^53 and 2^53 + 2 rounds to even.
+  REQUIRE(parse("9007199254740993") == 9007199254740992.0);
+  REQUIRE(parse("9007199254740995") == 9007199254740996.0);
+  REQUIRE(parse("1.7976931348623157e308") == DBL_MAX);
+  REQUIRE(parse("1.7976931348623158e308") == DBL_MAX);
+  REQUIRE(std::isinf(parse("1.7976931348623159e308")));
+  REQUIRE(std::isinf(parse("1e400")));
+  REQUIRE(parse("2.2250738585072014e-308") == DBL_MIN);
+  REQUIRE(parse("2.2250738585072011e-308") == 2.2250738585072011e-308);
+  REQUIRE(parse("4.9406564584124654e-324") == std::numeric_limits<double>::denorm_min());
+  // Exactly half the smallest subnormal ties to zero, anything above
+  // it rounds up.
+  REQUIRE(parse("2.4703282292062327208828439643411068618252990130716238221279284125033775363510437593264991818081799618989828234772285886546332835517796989819938739800539093906315035659515570226392290858392449105184435931802849936536152500319370457678249219365623669863658480757001585769269903706311928279558551332927834338409351978015531246597263579574622766465272827220056374006485499977096599470454020828166226237857393450736339007967761930577506740176324673600968951340535537458516661134223766678604162159680461914467291840300530057530849048765391711386591646239524912623653881879636239373280423891018672348497668235089863388587925628302755995657524455507255189313690836254779186948667994968324049705821028513185451396213837722826145437693412532098591327667236328125e-324") == 0.0);
+  REQUIRE(parse("2.4703282292062327208828439643411068618252990130716238221279284125033775363510437593264991818081799618989828234772285886546332835517796989819938739800539093906315035659515570226392290858392449105184435931802849936536152500319370457678249219365623669863658480757001585769269903706311928279558551332927834338409351978015531246597263579574622766465272827220056374006485499977096599470454020828166226237857393450736339007967761930577506740176324673600968951340535537458516661134223766678604162159680461914467291840300530057530849048765391711386591646239524912623653881879636239373280423891018672348497668235089863388587925628302755995657524455507255189313690836254779186948667994968324049705821028513185451396213837722826145437693412532098591327667236328125001e-324") == std::numeric_limits<double>::denorm_min());
+  REQUIRE(parse("1e-400") == 0.0);
+  REQUIRE(parse("0.000000000000000000000000000000000000000001e42") == 1.0);
+  REQUIRE(parse("100000000000000000000000000000000000000000e-40") == 10.0);
+}
+
+TEST_CASE("Number parsing round trips every double.", NUMBER) {
+  uint64_t state = 42;
+  char buffer[64];
+  for (int i = 0; i < 100000; i++) {
+    uint64_t pattern = next_random(state);
+    double value;
+    std::memcpy(&value, &pattern, sizeof(value));
+    if (!std::isfinite(value)) {
+      continue;
+    }
+    std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+    double parsed;
+    REQUIRE(number::parse(buffer, std::strlen(buffer), parsed));
+    REQUIRE(bits(parsed) == bits(value));
+  }
+}
+
+TEST_CASE("Number parsing agrees with strtod on long literals.", NUMBER) {
+  uint64_t state = 7;
+  for (int i = 0; i < 20000; i++) {
+    std::string text;
+    int digits = 1 + next_random(state) % 40;
+    int point = next_random(state) % (digits + 1);
+    for (int j = 0; j < digits; j++) {
+      if ((j == point) && (j != 0)) {
+	text += '.';
+      }
+      text += (char) ('0' + next_random(state) % 10);
+    }
+    int exponent = (int) (next_random(state) % 700) - 350;
+    text += "e" + std::to_string(exponent);
+    REQUIRE(bits(parse(text)) == bits(std::strtod(text.c_str(), nullptr)));
+  }
+}
@@ -3,8 +3,13 @@
 #include <ostream>
 #include <cctype>
 #include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <thread>
 
 #include "tokenize.hpp"
+#include "scan.hpp"
+#include "number.hpp"
 
 namespace token {
   std::list<Token> tokenize(std::istream & stream) {
@@ -69,6 +74,251 @@ namespace token {
     return tokens;
   }
 
+  Lexer::Lexer(const char * data, size_t size) {
+    this->begin = data;
+    this->cursor = data;
+    this->end = data + size;
+    this->replay = nullptr;
+    this->replay_end = nullptr;
+  }
+
+  Lexer::Lexer(const char * data, size_t size, const std::vector<TokenView> & tokens) {
+    this->begin = data;
+    this->cursor = data;
+    this->end = data + size;
+    this->replay = tokens.data();
+    this->replay_end = tokens.data() + tokens.size();
+  }
+
+  const char * Lexer::getData() const {
+    return begin;
+  }
+
+  uint32_t Lexer::getOffset() const {
+    if (replay != nullptr) {
+      return (replay != replay_end) ? replay->offset : end - begin;
+    }
+    return cursor - begin;
+  }
+
+  bool Lexer::next(TokenView & view) {
+    if (replay != nullptr) {
+      if (replay == replay_end) {
+	return false;
+      }
+      view = *replay++;
+      return true;
+    }
+    while (cursor != end) {
+      switch (*cursor) {
+      case '(':
+	view.type = OPEN_PAREN;
+	view.offset = cursor - begin;
+	view.length = 1;
+	cursor++;
+	return true;
+      case ')':
+	view.type = CLOSE_PAREN;
+	view.offset = cursor - begin;
+	view.length = 1;
+	cursor++;
+	return true;
+      case ';':
+	cursor = scan::find_newline(cursor, end);
+	if (cursor != end) {
+	  cursor++;
+	}
+	break;
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n':
+	{
+	  // Lines are worked out later from the offsets, if ever.
+	  size_t lines = 0;
+	  cursor = scan::skip_space(cursor, end, lines);
+	  break;
+	}
+      default:
+	{
+	  const char * start = cursor;
+	  cursor = scan::find_delimiter(cursor, end);
+	  view.type = classify(start, cursor - start);
+	  view.offset = start - begin;
+	  view.length = cursor - start;
+	  return true;
+	}
+      }
+    }
+    return false;
+  }
+
+  bool is_number(const char * text, size_t length) {
+    return number::match(text, length);
+  }
+
+  Type classify(const char * text, size_t length) {
+    switch (length) {
+    case 4:
+      if (std::memcmp(text, "True", 4) == 0) {
+	return BOOL;
+      } else if (std::memcmp(text, "None", 4) == 0) {
+	return NONE;
+      }
+      break;
+    case 5:
+      if (std::memcmp(text, "False", 5) == 0) {
+	return BOOL;
+      }
+      break;
+    }
+    if (is_number(text, length)) {
+      return NUMBER;
+    } else if ((length != 0) && !isdigit(static_cast<unsigned char>(text[0]))) {
+      return SYMBOL;
+    }
+    return ATOM;
+  }
+
+  std::vector<TokenView> tokenize(const char * data, size_t size) {
+    std::vector<TokenView> tokens;
+    // A rough guess so that big inputs don't spend their time regrowing.
+    tokens.reserve(size / 4);
+    Lexer lexer(data, size);
+    TokenView view;
+    while (lexer.next(view)) {
+      tokens.push_back(view);
+    }
+    return tokens;
+  }
+
+  ParallelOptions::ParallelOptions() {
+    this->threshold = 8 << 20;
+    this->threads = 0;
+  }
+
+  /*
+   * Find the first point at or after from that's just past a newline.
+   * A fresh lexer would read a vertical tab or form feed there as part
+   * of an atom, while the sequential lexer might still be skipping
+   * whitespace, so those points are passed over.
+   */
+  static size_t safe_point(const char * data, size_t size, size_t from) {
+    const char * end = data + size;
+    const char * cursor = scan::find_newline(data + from, end);
+    while (cursor != end) {
+      cursor++;
+      if ((cursor == end) || ((*cursor != '\v') && (*cursor != '\f'))) {
+	return cursor - data;
+      }
+      cursor = scan::find_newline(cursor, end);
+    }
+    return size;
+  }
+
+  std::vector<Chunk> split_chunks(const char * data, size_t size, size_t count) {
+    std::vector<Chunk> chunks;
+    size_t begin = 0;
+    for (size_t i = 1; (i <= count) && (begin < size); i++) {
+      size_t end = size;
+      if (i < count) {
+	size_t target = size / count * i;
+	if (target <= begin) {
+	  continue;
+	}
+	end = safe_point(data, size, target);
+      }
+      Chunk chunk;
+      chunk.begin = begin;
+      chunk.end = end;
+      chunk.depth = 0;
+      chunks.push_back(chunk);
+      begin = end;
+    }
+    return chunks;
+  }
+
+  /*
+   * Lex one chunk. Offsets come out relative to the whole buffer, and
+   * the chunk's change in paren depth is returned.
+   */
+  static int32_t tokenize_chunk(const char * data, const Chunk & chunk,
+				std::vector<TokenView> & tokens) {
+    tokens.reserve((chunk.end - chunk.begin) / 4);
+    Lexer lexer(data + chunk.begin, chunk.end - chunk.begin);
+    TokenView view;
+    int32_t depth = 0;
+    while (lexer.next(view)) {
+      view.offset += chunk.begin;
+      if (view.type == OPEN_PAREN) {
+	depth++;
+      } else if (view.type == CLOSE_PAREN) {
+	depth--;
+      }
+      tokens.push_back(view);
+    }
+    return depth;
+  }
+
+  std::vector<TokenView> tokenize_parallel(const char * data, size_t size,
+					   const ParallelOptions & options,
+					   std::vector<Chunk> * chunks_out) {
+    unsigned threads = options.threads;
+    if (threads == 0) {
+      threads = std::thread::hardware_concurrency();
+    }
+    if ((size < options.threshold) || (threads <= 1)) {
+      if (chunks_out != nullptr) {
+	*chunks_out = split_chunks(data, size, 1);
+      }
+      return tokenize(data, size);
+    }
+
+    // A few chunks per thread, so that one slow chunk doesn't hold up
+    // the rest.
+    std::vector<Chunk> chunks = split_chunks(data, size, threads * 4);
+    std::vector<std::vector<TokenView> > pieces(chunks.size());
+    std::vector<int32_t> deltas(chunks.size());
+    std::atomic<size_t> next_chunk(0);
+    auto worker = [&]() {
+      size_t i;
+      while ((i = next_chunk++) < chunks.size()) {
+	deltas[i] = tokenize_chunk(data, chunks[i], pieces[i]);
+      }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) {
+      pool.push_back(std::thread(worker));
+    }
+    worker();
+    for (auto & thread : pool) {
+      thread.join();
+    }
+
+    // Stitch the pieces together. The depth at the start of each chunk
+    // is the sum of the changes before it.
+    size_t total = 0;
+    int32_t depth = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+      total += pieces[i].size();
+      chunks[i].depth = depth;
+      depth += deltas[i];
+    }
+    std::vector<TokenView> tokens;
+    tokens.reserve(total);
+    for (auto & piece : pieces) {
+      tokens.insert(tokens.end(), piece.begin(), piece.end());
+    }
+    if (chunks_out != nullptr) {
+      *chunks_out = chunks;
+    }
+    return tokens;
+  }
+
+  Token to_token(const TokenView & view, const char * data, size_t lineNumber) {
+    return Token(view.type, std::string(data + view.offset, view.length), lineNumber);
+  }
+
   Token::Token(Type type, std::string text, size_t lineNumber) {
     this->type = type;
     this->text = text;
@@ -93,7 +343,7 @@ namespace token {
     return this->type;
   }
 
-  std::string Token::getText() const {
+  const std::string & Token::getText() const {
     return this->text;
   }
 
@@ -1,5 +1,8 @@
 #include <list>
+#include <vector>
 #include <string>
+#include <cstddef>
+#include <cstdint>
 #include <iostream>
 
 #ifndef TOKEN_H
@@ -7,9 +10,12 @@
 
 namespace token {
   /*
-   * A token can either be an opening paren, a closing paren, or an atom.
+   * A token can either be an opening paren, a closing paren, or an
+   * atom. The buffer lexer goes further and works out what kind of
+   * atom it saw. ATOM is left for atoms it couldn't classify (and for
+   * every atom out of the stream tokenizer).
    */
-  enum Type { OPEN_PAREN, CLOSE_PAREN, ATOM };
+  enum Type { OPEN_PAREN, CLOSE_PAREN, ATOM, NUMBER, BOOL, NONE, SYMBOL };
 
   /*
    * This class represents a token for the parser. It includes the
@@ -20,7 +26,7 @@ namespace token {
     Token(Type type, std::string text, size_t lineNumber);
     Token(const Token & other);
     Type getType() const;
-    std::string getText() const;
+    const std::string & getText() const;
     size_t getLineNumber() const;
     bool operator==(const Token & other) const;
     bool operator!=(const Token & other) const;
@@ -36,6 +42,104 @@ namespace token {
    * returned so that the parser can pull tokens off the list.
    */
   std::list<Token> tokenize(std::istream & stream);
+
+  /*
+   * A token that points into a contiguous source buffer instead of
+   * owning its text. The buffer has to outlive the view. Positions are
+   * byte offsets. A source::LineIndex turns them into lines and
+   * columns when a diagnostic needs them.
+   */
+  struct TokenView {
+    uint32_t offset;
+    uint32_t length;
+    Type type;
+  };
+
+  /*
+   * Pulls token views off a contiguous buffer one at a time. It
+   * follows the same rules as the stream tokenizer, but never copies
+   * or allocates anything. Offsets are 32 bits, so the buffer can't be
+   * bigger than 4 GB. It can also hand out tokens that were already
+   * cut out of the buffer, for instance by tokenize_parallel.
+   */
+  class Lexer {
+  public:
+    Lexer(const char * data, size_t size);
+    Lexer(const char * data, size_t size, const std::vector<TokenView> & tokens);
+    bool next(TokenView & view);
+    const char * getData() const;
+    uint32_t getOffset() const;
+  private:
+    const char * begin;
+    const char * cursor;
+    const char * end;
+    const TokenView * replay;
+    const TokenView * replay_end;
+  };
+
+  /*
+   * Take a buffer (a whole file, or an -e argument) and return views
+   * of all its tokens. Nothing is copied out of the buffer.
+   */
+  std::vector<TokenView> tokenize(const char * data, size_t size);
+
+  /*
+   * Settings for tokenize_parallel. Buffers smaller than threshold
+   * are tokenized on the calling thread. A threads of 0 means one per
+   * core.
+   */
+  struct ParallelOptions {
+    ParallelOptions();
+    size_t threshold;
+    unsigned threads;
+  };
+
+  /*
+   * A piece of a buffer that can be tokenized on its own. depth is
+   * the paren depth at its start.
+   */
+  struct Chunk {
+    uint32_t begin;
+    uint32_t end;
+    int32_t depth;
+  };
+
+  /*
+   * Cut a buffer into about count chunks. Each chunk starts just after
+   * a newline, because the lexer is always in its starting state
+   * there: a newline ends any comment or atom. The depths are left at
+   * zero until the chunks have been tokenized.
+   */
+  std::vector<Chunk> split_chunks(const char * data, size_t size, size_t count);
+
+  /*
+   * The same as tokenize, but the chunks are lexed by several threads
+   * and the results stitched back together. The tokens are identical
+   * to the sequential ones. If chunks isn't null, it gets the chunks
+   * that were used, with each one's starting paren depth filled in by
+   * a prefix sum.
+   */
+  std::vector<TokenView> tokenize_parallel(const char * data, size_t size,
+					   const ParallelOptions & options,
+					   std::vector<Chunk> * chunks = nullptr);
+
+  /*
+   * Work out what kind of atom some text is: NUMBER, BOOL, NONE or
+   * SYMBOL. ATOM is returned for text that isn't a valid atom, like
+   * "1abc".
+   */
+  Type classify(const char * text, size_t length);
+
+  /*
+   * Return true if the text is a number literal.
+   */
+  bool is_number(const char * text, size_t length);
+
+  /*
+   * Copy the text of a view out of its buffer into a full token. The
+   * view doesn't know its line, so the caller has to pass it in.
+   */
+  Token to_token(const TokenView & view, const char * data, size_t lineNumber);
 }
 
 #endif
@@ -8,10 +8,14 @@
 #include <sstream>
 #include <istream>
 #include <fstream>
+#include <string>
+#include <vector>
 
 #include "interpreter.hpp"
 #include "expression.hpp"
 #include "interpreter_semantic_error.hpp"
+#include "source.hpp"
+#include "compiled.hpp"
 
 /*
  * This is a little helper function for displaying expressions to the
@@ -41,6 +45,102 @@ void print_expression(Expression expr) {
   std::cout << ")" << std::endl;
 }
 
+/*
+ * Print where the interpreter's last error happened, if it knows, or
+ * where all of its syntax errors are. The line index is only built
+ * once something has actually gone wrong.
+ */
+void print_error_position(const std::string & name, const Interpreter & interpreter,
+			  const char * data, size_t size) {
+  if (!interpreter.hasErrorOffset()) {
+    return;
+  }
+  source::LineIndex lines(data, size);
+  // A failed parse has every syntax error in the file.
+  if (!interpreter.getDiagnostics().empty()) {
+    for (auto const & diagnostic : interpreter.getDiagnostics()) {
+      source::Position position = lines.locate(diagnostic.offset);
+      std::cerr << name << ":" << position.line << ":" << position.column
+		<< ": error: " << diagnostic.message << std::endl;
+    }
+    return;
+  }
+  source::Position position = lines.locate(interpreter.getErrorOffset());
+  std::cerr << name << ":" << position.line << ":" << position.column
+	    << ": error" << std::endl;
+}
+
+/*
+ * Return true if a .vtc file was compiled from something other than
+ * the source next to it. The source of foo.vtc is taken to be foo.vts;
+ * a file without one has nothing to go stale against.
+ */
+bool is_stale(const std::string & name, const char * data, size_t size) {
+  const std::string extension = ".vtc";
+  if ((name.size() <= extension.size()) ||
+      (name.compare(name.size() - extension.size(), extension.size(), extension) != 0)) {
+    return false;
+  }
+  source::Buffer source;
+  if (!source.open(name.substr(0, name.size() - extension.size()) + ".vts")) {
+    return false;
+  }
+  return !compiled::matches(data, size, source.getData(), source.getSize());
+}
+
+/*
+ * Run a script one top-level form at a time. Each form is parsed,
+ * evaluated, printed and thrown away before the next one is read, and
+ * definitions carry over from one form to the next. It stops at the
+ * first form that fails. Error positions are counted from the start of
+ * the whole stream.
+ */
+int run_stream(const std::string & name, std::istream & stream) {
+  Interpreter interpreter;
+  source::FormReader reader(stream);
+  std::string form;
+  while (reader.next(form)) {
+    bool ok = interpreter.parse(form.data(), form.size());
+    if (ok) {
+      try {
+	print_expression(interpreter.eval());
+      } catch (InterpreterSemanticError e) {
+	ok = false;
+      }
+    }
+    if (ok) {
+      continue;
+    }
+    std::cout << "Error" << std::endl;
+    if (!interpreter.hasErrorOffset()) {
+      return EXIT_FAILURE;
+    }
+    // Positions in the form are moved to where the form starts.
+    source::LineIndex lines(form.data(), form.size());
+    source::Position start = reader.getPosition();
+    std::vector<Diagnostic> errors = interpreter.getDiagnostics();
+    if (errors.empty()) {
+      Diagnostic error = Diagnostic();
+      error.offset = interpreter.getErrorOffset();
+      errors.push_back(error);
+    }
+    for (auto const & error : errors) {
+      source::Position position = lines.locate(error.offset);
+      if (position.line == 1) {
+	position.column += start.column - 1;
+      }
+      position.line += start.line - 1;
+      std::cerr << name << ":" << position.line << ":" << position.column << ": error";
+      if (!error.message.empty()) {
+	std::cerr << ": " << error.message;
+      }
+      std::cerr << std::endl;
+    }
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
 /*
  * The main routine. It can run vtscript code in one of three ways
  * depending on how it's called. If the program is called with no
@@ -49,11 +149,22 @@ void print_expression(Expression expr) {
  * file. Finally, if the program is called with '-e' and then a string
  * containting vtscript code, the program will attempt to run that
  * string. This last behavior is similar to 'python -c' or 'perl -e'.
+ * With '--compile', a file name, '-o' and an output name, the program
+ * compiles the file into the .vtc format instead of running it. A .vtc
+ * file can then be run like any other file, but without being parsed.
+ * If foo.vtc has a foo.vts next to it that it wasn't compiled from, it
+ * won't run.
+ * With '--stream' and a file name ('-' for standard input), the file
+ * may hold any number of top-level forms. They are run one at a time
+ * as they're read and each result is printed.
  */
 int main(int argc, char * argv[]) {
   Interpreter interpreter;
   // Interpretter case.
   if (argc == 1) {
+    // The same lines tend to be typed again and again.
+    cache::ParseCache cache(256);
+    interpreter.setParseCache(&cache);
     std::string line;
     while (true) {
       std::cout << "vtscript>";
@@ -65,6 +176,7 @@ int main(int argc, char * argv[]) {
 	} catch (InterpreterSemanticError e) {
 	  std::cout << "Error" << std::endl;
 	  interpreter = Interpreter();
+	  interpreter.setParseCache(&cache);
 	}
       } else {
 	std::cout << "Error" << std::endl;
@@ -73,32 +185,86 @@ int main(int argc, char * argv[]) {
     }
     // File case.
   } else if (argc == 2) {
-    std::ifstream stream(argv[1]);
-    if (!stream.good()) {
+    source::Buffer buffer;
+    if (!buffer.open(argv[1])) {
 	std::cout << "Error" << std::endl;
 	return EXIT_FAILURE;
     }
-    std::ifstream & stream_ref = stream;
-    if(interpreter.parse(stream_ref)){
+    // Compiled files are loaded instead of parsed. Their offsets point
+    // into a source that isn't here, so errors can't be placed.
+    bool precompiled = compiled::is_compiled(buffer.getData(), buffer.getSize());
+    if (precompiled && is_stale(argv[1], buffer.getData(), buffer.getSize())) {
+      std::cout << "Error" << std::endl;
+      std::cerr << argv[1] << ": error: compiled from an older version of its .vts source"
+		<< std::endl;
+      return EXIT_FAILURE;
+    }
+    bool loaded = precompiled ? interpreter.load(buffer.getData(), buffer.getSize())
+      : interpreter.parse(buffer.getData(), buffer.getSize());
+    if (loaded) {
       try {
 	print_expression(interpreter.eval());
       } catch (InterpreterSemanticError e) {
+	if (!precompiled) {
+	  print_error_position(argv[1], interpreter, buffer.getData(), buffer.getSize());
+	}
 	interpreter = Interpreter();
       }
+    } else if (precompiled) {
+      std::cout << "Error" << std::endl;
+      return EXIT_FAILURE;
+    } else {
+      print_error_position(argv[1], interpreter, buffer.getData(), buffer.getSize());
+    }
+    // Compile case.
+  } else if ((argc == 5) && (std::string(argv[1]) == "--compile") &&
+	     (std::string(argv[3]) == "-o")) {
+    source::Buffer buffer;
+    if (!buffer.open(argv[2])) {
+      std::cout << "Error" << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::string output;
+    if (!compiled::compile(buffer.getData(), buffer.getSize(), output)) {
+      std::cout << "Error" << std::endl;
+      if (!interpreter.parse(buffer.getData(), buffer.getSize())) {
+	print_error_position(argv[2], interpreter, buffer.getData(), buffer.getSize());
+      }
+      return EXIT_FAILURE;
+    }
+    std::ofstream file(argv[4], std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(output.data(), output.size());
+    if (!file.good()) {
+      std::cout << "Error" << std::endl;
+      return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+    // Stream case.
+  } else if ((argc == 3) && (std::string(argv[1]) == "--stream")) {
+    if (std::string(argv[2]) == "-") {
+      return run_stream("-", std::cin);
+    }
+    std::ifstream file(argv[2], std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+      std::cout << "Error" << std::endl;
+      return EXIT_FAILURE;
     }
+    return run_stream(argv[2], file);
     // -e Case
   } else if ((argc == 3) && (std::string(argv[1]) == "-e")) {
-    std::stringstream stream(argv[2]);
-    if (interpreter.parse(stream)) {
+    std::string text(argv[2]);
+    if (interpreter.parse(text.data(), text.size())) {
       try {
 	print_expression(interpreter.eval());
       } catch (InterpreterSemanticError e) {
 	std::cout << "Error" << std::endl;
+	print_error_position("-e", interpreter, text.data(), text.size());
 	return EXIT_FAILURE;
       }
       return EXIT_SUCCESS;
     } else {
       std::cout << "Error" << std::endl;
+      print_error_position("-e", interpreter, text.data(), text.size());
       return EXIT_FAILURE;
     }
   }
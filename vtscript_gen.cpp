@@ -0,0 +1,77 @@
+/*
+ * Generates vtscript programs for benchmarks and load tests. The
+ * output only depends on the options, so a seed names the same program
+ * on every machine.
+ *
+ * Usage: vtscript_gen [--seed N] [--forms N] [--bytes N] [--depth N]
+ *                     [--fanout N] [--defines N] [--reuse P]
+ *                     [--if-density P] [--comment-density P] [-o FILE]
+ *
+ * N is a count and P a probability between 0 and 1. See
+ * generate::Options for what each knob does. The program goes to
+ * stdout unless -o is given.
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "generate.hpp"
+
+void usage(const char * name) {
+  std::cerr << "usage: " << name
+	    << " [--seed N] [--forms N] [--bytes N] [--depth N] [--fanout N]"
+	    << " [--defines N] [--reuse P] [--if-density P] [--comment-density P]"
+	    << " [-o FILE]" << std::endl;
+}
+
+int main(int argc, char * argv[]) {
+  generate::Options options;
+  std::string output;
+  for (int i = 1; i < argc; i++) {
+    std::string flag = argv[i];
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    const char * value = argv[++i];
+    if (flag == "--seed") {
+      options.seed = std::strtoull(value, nullptr, 10);
+    } else if (flag == "--forms") {
+      options.forms = std::strtoull(value, nullptr, 10);
+    } else if (flag == "--bytes") {
+      options.bytes = std::strtoull(value, nullptr, 10);
+    } else if (flag == "--depth") {
+      options.depth = std::atoi(value);
+    } else if (flag == "--fanout") {
+      options.fanout = std::atoi(value);
+    } else if (flag == "--defines") {
+      options.defines = std::strtoull(value, nullptr, 10);
+    } else if (flag == "--reuse") {
+      options.reuse = std::atof(value);
+    } else if (flag == "--if-density") {
+      options.if_density = std::atof(value);
+    } else if (flag == "--comment-density") {
+      options.comment_density = std::atof(value);
+    } else if (flag == "-o") {
+      output = value;
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::string text = generate::program(options);
+  if (output.empty()) {
+    std::cout << text;
+  } else {
+    std::ofstream stream(output, std::ios::out | std::ios::binary);
+    stream << text;
+    if (!stream.good()) {
+      std::cerr << "Error" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}